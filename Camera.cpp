@@ -1,7 +1,7 @@
 #include "Camera.hpp"
 
 Camera::Camera(bool orthographic, double fov, double aspect, double nearClip, Vector3 position, double yaw, double pitch, double roll)
-    : fov{ fov }, perspective{ tan(fov / 2.0) }, aspect{ aspect }, nearClip{ nearClip }, position{ position }, yaw{ yaw }, pitch{ pitch }, roll{ roll },
+    : fov{ fov }, perspective{ tan(fov / 2.0) }, aspect{ aspect }, nearClip{ nearClip }, farClip{ 1000.0 }, position{ position }, yaw{ yaw }, pitch{ pitch }, roll{ roll },
     combinedTransform{ &positionTransform, &yawTransform, &pitchTransform, &rollTransform }
 {
     setOrthographic(orthographic);
@@ -37,6 +37,11 @@ void Camera::setNearClip(double nearClip)
     this->nearClip = nearClip;
 }
 
+void Camera::setFarClip(double farClip)
+{
+    this->farClip = farClip;
+}
+
 void Camera::setPosition(Vector3 position)
 {
     this->position = position;
@@ -110,6 +115,11 @@ double Camera::getNearClip() const
     return nearClip;
 }
 
+double Camera::getFarClip() const
+{
+    return farClip;
+}
+
 Vector3 Camera::getPosition() const
 {
     return position;
@@ -12,6 +12,7 @@ public:
     void setFov(double fov);
     void setAspect(double aspect);
     void setNearClip(double nearClip);
+    void setFarClip(double farClip);
     void setPosition(Vector3 position);
     void setYaw(double yaw);
     void setPitch(double pitch);
@@ -27,6 +28,7 @@ public:
     double getPerspective() const;
     double getAspect() const;
     double getNearClip() const;
+    double getFarClip() const;
     Vector3 getPosition() const;
     double getYaw() const;
     double getPitch() const;
@@ -46,6 +48,7 @@ private:
     double perspective;
     double aspect;
     double nearClip;
+    double farClip;
     Vector3 position;
     double yaw;
     double pitch;
@@ -0,0 +1,122 @@
+#include "DepthBuffer.hpp"
+
+DepthBuffer::DepthBuffer()
+    : DepthBuffer{ 0, Format::FLOAT64 }
+{
+}
+
+DepthBuffer::DepthBuffer(int size, Format format)
+    : size{ size }
+{
+    setPerspective(1.0);
+    setFormat(format);
+}
+
+void DepthBuffer::setFormat(Format format)
+{
+    this->format = format;
+    data64.clear();
+    data32.clear();
+    data24.clear();
+    data16.clear();
+    data64.shrink_to_fit();
+    data32.shrink_to_fit();
+    data24.shrink_to_fit();
+    data16.shrink_to_fit();
+    clear();
+}
+
+DepthBuffer::Format DepthBuffer::getFormat() const
+{
+    return format;
+}
+
+int DepthBuffer::getSize() const
+{
+    return size;
+}
+
+void DepthBuffer::setPerspective(double nearDepth)
+{
+    orthographic = false;
+    this->nearDepth = nearDepth;
+}
+
+void DepthBuffer::setOrthographic(double farDepth)
+{
+    orthographic = true;
+    this->farDepth = farDepth;
+    oneOverRange = 1.0 / (2.0 * farDepth);
+}
+
+void DepthBuffer::clear()
+{
+    switch (format)
+    {
+    case Format::FLOAT64:
+        data64.assign(size, 0.0);
+        break;
+    case Format::FLOAT32:
+        data32.assign(size, 0.0f);
+        break;
+    case Format::UINT24:
+        data24.assign(size, 0);
+        break;
+    case Format::UINT16:
+        data16.assign(size, 0);
+        break;
+    }
+}
+
+void DepthBuffer::clear(int index, int count)
+{
+    switch (format)
+    {
+    case Format::FLOAT64:
+        std::fill(data64.begin() + index, data64.begin() + index + count, 0.0);
+        break;
+    case Format::FLOAT32:
+        std::fill(data32.begin() + index, data32.begin() + index + count, 0.0f);
+        break;
+    case Format::UINT24:
+        std::fill(data24.begin() + index, data24.begin() + index + count, 0);
+        break;
+    case Format::UINT16:
+        std::fill(data16.begin() + index, data16.begin() + index + count, 0);
+        break;
+    }
+}
+
+void DepthBuffer::getDistances(int index, int count, float* distances) const
+{
+    auto convert = [this, count, distances](const auto* data, double scale)
+    {
+        if (orthographic)
+        {
+            double factor = -scale * 2.0 * farDepth;
+            for (int i = 0; i < count; i++)
+                distances[i] = (float) (farDepth + data[i] * factor);
+        }
+        else
+        {
+            double factor = nearDepth / scale;
+            for (int i = 0; i < count; i++)
+                distances[i] = (float) (factor / data[i]);
+        }
+    };
+    switch (format)
+    {
+    case Format::FLOAT64:
+        convert(data64.data() + index, 1.0);
+        break;
+    case Format::FLOAT32:
+        convert(data32.data() + index, 1.0);
+        break;
+    case Format::UINT24:
+        convert(data24.data() + index, 1.0 / 0xFFFFFF);
+        break;
+    case Format::UINT16:
+        convert(data16.data() + index, 1.0 / 0xFFFF);
+        break;
+    }
+}
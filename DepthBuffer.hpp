@@ -0,0 +1,170 @@
+#ifndef DEPTHBUFFER_HPP
+#define DEPTHBUFFER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+// Stores depth as a normalized reversed value: 1.0 at the near plane
+// falling to 0.0 at the far end, and cleared to 0.0. Perspective depth is
+// stored as a scaled 1 / z, so the rasterizer can test its interpolated
+// reciprocal directly. Orthographic depth is linear over [-far, far].
+class DepthBuffer
+{
+public:
+    enum class Format
+    {
+        FLOAT64, FLOAT32, UINT24, UINT16
+    };
+
+    DepthBuffer();
+    DepthBuffer(int size, Format format);
+
+    void setFormat(Format format);
+    Format getFormat() const;
+    int getSize() const;
+
+    // Perspective values passed to test and write are 1 / z, where z equals
+    // nearDepth on the near plane
+    void setPerspective(double nearDepth);
+    // Orthographic values are z itself
+    void setOrthographic(double farDepth);
+
+    void clear();
+    // Clears count consecutive values
+    void clear(int index, int count);
+
+    // True if value is strictly closer than the stored depth
+    bool passes(int index, double value) const
+    {
+        double normalized = normalize(value);
+        switch (format)
+        {
+        case Format::FLOAT64:
+            return normalized > data64[index];
+        case Format::FLOAT32:
+            return (float) normalized > data32[index];
+        case Format::UINT24:
+            return quantize(normalized, 0xFFFFFF) > data24[index];
+        case Format::UINT16:
+            return quantize(normalized, 0xFFFF) > data16[index];
+        }
+        return false;
+    }
+
+    // Same as passes, but also stores value when it passes
+    bool test(int index, double value)
+    {
+        double normalized = normalize(value);
+        switch (format)
+        {
+        case Format::FLOAT64:
+            if (normalized <= data64[index])
+                return false;
+            data64[index] = normalized;
+            return true;
+        case Format::FLOAT32:
+        {
+            float stored = (float) normalized;
+            if (stored <= data32[index])
+                return false;
+            data32[index] = stored;
+            return true;
+        }
+        case Format::UINT24:
+        {
+            uint32_t stored = quantize(normalized, 0xFFFFFF);
+            if (stored <= data24[index])
+                return false;
+            data24[index] = stored;
+            return true;
+        }
+        case Format::UINT16:
+        {
+            uint16_t stored = quantize(normalized, 0xFFFF);
+            if (stored <= data16[index])
+                return false;
+            data16[index] = stored;
+            return true;
+        }
+        }
+        return false;
+    }
+
+    void write(int index, double value)
+    {
+        double normalized = normalize(value);
+        switch (format)
+        {
+        case Format::FLOAT64:
+            data64[index] = normalized;
+            break;
+        case Format::FLOAT32:
+            data32[index] = (float) normalized;
+            break;
+        case Format::UINT24:
+            data24[index] = quantize(normalized, 0xFFFFFF);
+            break;
+        case Format::UINT16:
+            data16[index] = quantize(normalized, 0xFFFF);
+            break;
+        }
+    }
+
+    double getNormalized(int index) const
+    {
+        switch (format)
+        {
+        case Format::FLOAT64:
+            return data64[index];
+        case Format::FLOAT32:
+            return data32[index];
+        case Format::UINT24:
+            return data24[index] * (1.0 / 0xFFFFFF);
+        case Format::UINT16:
+            return data16[index] * (1.0 / 0xFFFF);
+        }
+        return 0.0;
+    }
+
+    // Depth in the same units the renderer interpolates (z, not 1 / z);
+    // cleared pixels are infinitely far in perspective
+    double getDistance(int index) const
+    {
+        double normalized = getNormalized(index);
+        if (orthographic)
+            return farDepth - normalized * 2.0 * farDepth;
+        return nearDepth / normalized;
+    }
+
+    // getDistance for count consecutive pixels, with the format and
+    // projection resolved once for the whole run
+    void getDistances(int index, int count, float* distances) const;
+private:
+    double normalize(double value) const
+    {
+        if (orthographic)
+            return (farDepth - value) * oneOverRange;
+        return value * nearDepth;
+    }
+
+    static uint32_t quantize(double normalized, uint32_t maxValue)
+    {
+        normalized = std::clamp(normalized, 0.0, 1.0);
+        return (uint32_t) (normalized * maxValue + 0.5);
+    }
+
+    int size;
+    Format format;
+    bool orthographic;
+    double nearDepth;
+    double farDepth;
+    double oneOverRange;
+
+    std::vector<double> data64;
+    std::vector<float> data32;
+    std::vector<uint32_t> data24;
+    std::vector<uint16_t> data16;
+};
+
+#endif
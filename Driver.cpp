@@ -16,21 +16,54 @@ void Driver::start()
     sf::RenderWindow window(sf::VideoMode(windowWidth, windowHeight), "3D Software Renderer", sf::Style::Close);
     window.setMouseCursorVisible(false);
 
-    Raster raster{ width, height };
     sf::Texture texture;
     texture.create(width, height);
     sf::Sprite sprite;
     sprite.setTexture(texture);
     sprite.setScale(scale, scale);
 
-    Renderer renderer{ &raster };
+    // Frames are uploaded and displayed on their own thread, which owns
+    // the window's GL context from here on, while this thread renders the
+    // next frame into another buffer. Events are still polled here
+    SwapChain swapChain{ width, height, 3 };
+    window.setActive(false);
+    std::thread presenter{ [&window, &texture, &sprite, &swapChain]()
+    {
+        window.setActive(true);
+        while (Raster* frame = swapChain.takeFrame())
+        {
+            texture.update(frame->getData());
+            swapChain.release(frame);
+
+            window.clear(sf::Color::Black);
+            window.draw(sprite);
+            window.display();
+        }
+        window.setActive(false);
+    } };
+
+    Raster* target = swapChain.acquire();
+    Renderer renderer{ target };
+    renderer.enableBinning(true);
+    renderer.enableFastClears(true);
+    renderer.setDepthFormat(DepthBuffer::Format::FLOAT32);
+    renderer.setPerspectiveCorrection(Renderer::PerspectiveCorrection::SPAN_16);
+    renderer.setMipmapSelection(Renderer::MipmapSelection::PER_SPAN);
+    renderer.setSampler(Sampler{ Sampler::Filter::BILINEAR, Sampler::Address::REPEAT });
+
+    PostProcess postProcess;
+    postProcess.setTonemap(1.2, 3.0);
+    postProcess.setVignette(0.4, 0.5);
+    bool postProcessEnabled = true;
 
     Mesh* bricks = Mesh::loadFromFile("bricks.obj", Mesh::Shading::KEEP_NORMALS);
     Raster bricksTex{ 728, 473 };
+    bricksTex.setLayout(Raster::Layout::TILED);
 
     sf::Image image;
     image.loadFromFile("bricks.jpg");
     bricksTex.loadFromBuffer(image.getPixelsPtr());
+    bricksTex.generateMipmaps();
 
     Camera camera(false, 1.57, width / (double) height, 0.1, Vector3{ 0.0, 0.0, 5.0 });
 
@@ -55,7 +88,8 @@ void Driver::start()
     sf::Time fpsTimer;
     int frames = 0;
 
-    while (window.isOpen())
+    bool running = true;
+    while (running)
     {
         sf::Time now = timer.getElapsedTime();
         sf::Time delta = now - lastTime;
@@ -75,7 +109,7 @@ void Driver::start()
         while (window.pollEvent(event))
         {
             if (event.type == sf::Event::Closed)
-                window.close();
+                running = false;
             if (event.type == sf::Event::KeyPressed)
             {
                 if (event.key.code == sf::Keyboard::W)
@@ -90,8 +124,46 @@ void Driver::start()
                     qDown = true;
                 if (event.key.code == sf::Keyboard::E)
                     eDown = true;
+                if (event.key.code == sf::Keyboard::R)
+                {
+                    bool scanline = renderer.getRasterizer() == Renderer::Rasterizer::SCANLINE;
+                    renderer.setRasterizer(scanline ? Renderer::Rasterizer::EDGE_FUNCTION : Renderer::Rasterizer::SCANLINE);
+                    std::cout << "Rasterizer: " << (scanline ? "edge function" : "scanline") << std::endl;
+                }
+                if (event.key.code == sf::Keyboard::M)
+                {
+                    Renderer::MipmapSelection selection = renderer.getMipmapSelection();
+                    if (selection == Renderer::MipmapSelection::NONE)
+                    {
+                        renderer.setMipmapSelection(Renderer::MipmapSelection::PER_TRIANGLE);
+                        std::cout << "Mipmaps: per triangle" << std::endl;
+                    }
+                    else if (selection == Renderer::MipmapSelection::PER_TRIANGLE)
+                    {
+                        renderer.setMipmapSelection(Renderer::MipmapSelection::PER_SPAN);
+                        std::cout << "Mipmaps: per span" << std::endl;
+                    }
+                    else
+                    {
+                        renderer.setMipmapSelection(Renderer::MipmapSelection::NONE);
+                        std::cout << "Mipmaps: off" << std::endl;
+                    }
+                }
+                if (event.key.code == sf::Keyboard::F)
+                {
+                    Sampler sampler = renderer.getSampler();
+                    bool bilinear = sampler.getFilter() == Sampler::Filter::BILINEAR;
+                    sampler.setFilter(bilinear ? Sampler::Filter::NEAREST : Sampler::Filter::BILINEAR);
+                    renderer.setSampler(sampler);
+                    std::cout << "Filter: " << (bilinear ? "nearest" : "bilinear") << std::endl;
+                }
+                if (event.key.code == sf::Keyboard::P)
+                {
+                    postProcessEnabled = !postProcessEnabled;
+                    std::cout << "Post-processing: " << (postProcessEnabled ? "on" : "off") << std::endl;
+                }
                 if (event.key.code == sf::Keyboard::Escape)
-                    window.close();
+                    running = false;
             }
             if (event.type == sf::Event::KeyReleased)
             {
@@ -169,17 +241,22 @@ void Driver::start()
         camera.rotateYaw(camRotSpeed * -dmx * 0.016);
         camera.rotatePitch(camRotSpeed * -dmy * 0.016);
 
+        renderer.setImage(target);
         renderer.clearColorDepth(Color{ 0, 0, 0, 255 });
 
         Combined c;
         renderer.renderMesh(*bricks, bricksTex, c, camera, lights, Renderer::Lighting::DIFFUSE);
+        if (postProcessEnabled)
+            renderer.postProcess(postProcess);
 
-        texture.update(raster.getData());
-
-        window.clear(sf::Color::Black);
-        window.draw(sprite);
-        window.display();
+        renderer.resolveClears();
+        swapChain.submit(target);
+        target = swapChain.acquire();
     }
-    
+
+    swapChain.close();
+    presenter.join();
+    window.close();
+
     delete bricks;
 }
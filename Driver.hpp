@@ -2,10 +2,12 @@
 #define DRIVER_HPP
 
 #include <iostream>
+#include <thread>
 
 #include <SFML/Graphics.hpp>
 
 #include "Renderer.hpp"
+#include "SwapChain.hpp"
 
 class Driver
 {
@@ -0,0 +1,33 @@
+#ifndef FRAMESINK_HPP
+#define FRAMESINK_HPP
+
+#include "Raster.hpp"
+
+// Somewhere finished frames are streamed to, such as an encoder in another
+// process. The render loop draws straight into rasters the sink hands out,
+// so a sink that owns its memory never needs to copy a frame
+class FrameSink
+{
+public:
+    // What to do when the consumer falls behind: wait for it, or skip
+    // frames until it catches up
+    enum class Backpressure
+    {
+        BLOCK, DROP
+    };
+
+    virtual ~FrameSink() {}
+
+    // A LINEAR raster the size of the stream to draw the next frame into.
+    // nullptr if the frame should be skipped because the consumer is
+    // behind in DROP mode, or because the sink has closed
+    virtual Raster* acquireFrame() = 0;
+    // Publishes the frame from the last acquireFrame. False if it couldn't
+    // be delivered
+    virtual bool submitFrame(Raster* frame) = 0;
+
+    virtual bool isOpen() const = 0;
+    virtual int getDroppedFrames() const = 0;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(std::string file)
+    : open{ false }, data{ nullptr }, size{ 0 }
+{
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return;
+    }
+    size = info.st_size;
+    if (size > 0)
+    {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            data = nullptr;
+            size = 0;
+            close(fd);
+            return;
+        }
+        // Parsers read front to back, so the kernel can read well ahead
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    open = true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data != nullptr)
+        munmap(data, size);
+}
+
+bool MappedFile::isOpen() const
+{
+    return open;
+}
+
+const char* MappedFile::getData() const
+{
+    return static_cast<const char*>(data);
+}
+
+size_t MappedFile::getSize() const
+{
+    return size;
+}
@@ -0,0 +1,29 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped read-only into memory, so it can be parsed in place
+// without being copied into buffers first. The data is not null-terminated
+class MappedFile
+{
+public:
+    MappedFile(std::string file);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // False if the file couldn't be opened or mapped. An empty file is
+    // open with no data
+    bool isOpen() const;
+    const char* getData() const;
+    size_t getSize() const;
+private:
+    bool open;
+    void* data;
+    size_t size;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef MATH_HPP
 #define MATH_HPP
 
+#include "Simd.hpp"
+
 #include <cmath>
 #include <initializer_list>
 #include <vector>
@@ -168,6 +170,73 @@ struct Vector3
     double x, y, z;
 };
 
+struct Matrix3
+{
+    Matrix3()
+    : Matrix3{ Vector3{ 1.0, 0.0, 0.0 }, Vector3{ 0.0, 1.0, 0.0 }, Vector3{ 0.0, 0.0, 1.0 } }
+    {
+    }
+
+    Matrix3(Vector3 column0, Vector3 column1, Vector3 column2)
+        : m
+        {
+            { column0.x, column1.x, column2.x },
+            { column0.y, column1.y, column2.y },
+            { column0.z, column1.z, column2.z }
+        }
+    {
+    }
+
+    Vector3 apply(Vector3 v) const
+    {
+        return Vector3
+        {
+            m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+            m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+            m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z
+        };
+    }
+
+    void applyBatch(Float4& x, Float4& y, Float4& z) const
+    {
+        Float4 rx = Float4{ (float) m[0][0] } * x + Float4{ (float) m[0][1] } * y + Float4{ (float) m[0][2] } * z;
+        Float4 ry = Float4{ (float) m[1][0] } * x + Float4{ (float) m[1][1] } * y + Float4{ (float) m[1][2] } * z;
+        Float4 rz = Float4{ (float) m[2][0] } * x + Float4{ (float) m[2][1] } * y + Float4{ (float) m[2][2] } * z;
+        x = rx;
+        y = ry;
+        z = rz;
+    }
+
+    // this = this * other, so other is applied first
+    void mul(const Matrix3& other)
+    {
+        Matrix3 product = *this;
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 3; col++)
+                product.m[row][col] = m[row][0] * other.m[0][col] + m[row][1] * other.m[1][col] + m[row][2] * other.m[2][col];
+        *this = product;
+    }
+
+    // The inverse transpose scaled by the determinant. Normals only need the
+    // direction, and unlike the inverse it exists for singular matrices
+    Matrix3 cofactor() const
+    {
+        Matrix3 result;
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 3; col++)
+            {
+                int r0 = (row + 1) % 3, r1 = (row + 2) % 3;
+                int c0 = (col + 1) % 3, c1 = (col + 2) % 3;
+                result.m[row][col] = m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0];
+            }
+        return result;
+    }
+
+    double m[3][3];
+};
+
+class Matrix4;
+
 class Transform
 {
 public:
@@ -176,6 +245,42 @@ public:
     {
         return n;
     }
+
+    // Flattens the transform into one affine matrix. The default reads it
+    // off the images of the origin and the axes, which is exact for any
+    // affine transform
+    virtual Matrix4 toMatrix() const;
+
+    // Four vectors at once, one component per argument. The defaults fall
+    // back to the single-vector versions lane by lane
+    virtual void applyBatch(Float4& x, Float4& y, Float4& z) const
+    {
+        applyLanes(x, y, z, false);
+    }
+
+    virtual void applyNormalBatch(Float4& x, Float4& y, Float4& z) const
+    {
+        applyLanes(x, y, z, true);
+    }
+private:
+    void applyLanes(Float4& x, Float4& y, Float4& z, bool normal) const
+    {
+        float xs[4], ys[4], zs[4];
+        x.store(xs);
+        y.store(ys);
+        z.store(zs);
+        for (int i = 0; i < 4; i++)
+        {
+            Vector3 v{ xs[i], ys[i], zs[i] };
+            v = normal ? applyNormal(v) : apply(v);
+            xs[i] = (float) v.x;
+            ys[i] = (float) v.y;
+            zs[i] = (float) v.z;
+        }
+        x = Float4::load(xs);
+        y = Float4::load(ys);
+        z = Float4::load(zs);
+    }
 };
 
 class Combined : public Transform
@@ -203,6 +308,20 @@ public:
             n = chain[i]->applyNormal(n);
         return n;
     }
+
+    void applyBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        for (int i = 0; i < chain.size(); i++)
+            chain[i]->applyBatch(x, y, z);
+    }
+
+    void applyNormalBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        for (int i = 0; i < chain.size(); i++)
+            chain[i]->applyNormalBatch(x, y, z);
+    }
+
+    Matrix4 toMatrix() const override;
 private:
     std::vector<const Transform*> chain;
 };
@@ -230,6 +349,17 @@ public:
     {
         return n;
     }
+
+    void applyBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        x = x + Float4{ (float) translation.x };
+        y = y + Float4{ (float) translation.y };
+        z = z + Float4{ (float) translation.z };
+    }
+
+    void applyNormalBatch(Float4&, Float4&, Float4&) const override
+    {
+    }
 private:
     Vector3 translation;
 };
@@ -259,6 +389,20 @@ public:
         n.mul(normalScalars);
         return n;
     }
+
+    void applyBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        x = x * Float4{ (float) scalars.x };
+        y = y * Float4{ (float) scalars.y };
+        z = z * Float4{ (float) scalars.z };
+    }
+
+    void applyNormalBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        x = x * Float4{ (float) normalScalars.x };
+        y = y * Float4{ (float) normalScalars.y };
+        z = z * Float4{ (float) normalScalars.z };
+    }
 private:
     Vector3 scalars;
     Vector3 normalScalars;
@@ -310,10 +454,155 @@ public:
     {
         return apply(n);
     }
+
+    void applyBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        Float4 sines{ (float) s };
+        Float4 cosines{ (float) c };
+        switch (axis)
+        {
+        case Axis::X:
+        {
+            Float4 rotatedY = y * cosines - z * sines;
+            z = y * sines + z * cosines;
+            y = rotatedY;
+            break;
+        }
+        case Axis::Y:
+        {
+            Float4 rotatedZ = z * cosines - x * sines;
+            x = z * sines + x * cosines;
+            z = rotatedZ;
+            break;
+        }
+        case Axis::Z:
+        {
+            Float4 rotatedX = x * cosines - y * sines;
+            y = x * sines + y * cosines;
+            x = rotatedX;
+            break;
+        }
+        }
+    }
+
+    void applyNormalBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        applyBatch(x, y, z);
+    }
 private:
     Axis axis;
     double s;
     double c;
 };
 
+// Affine transform: a linear part followed by a translation. The normal
+// matrix is kept alongside so applyNormal is a single multiply too
+class Matrix4 : public Transform
+{
+public:
+    Matrix4()
+    : Matrix4{ Matrix3{}, Vector3{ 0.0, 0.0, 0.0 } }
+    {
+    }
+
+    Matrix4(Matrix3 linear, Vector3 translation)
+        : Matrix4{ linear, translation, linear.cofactor() }
+    {
+    }
+
+    Matrix4(Matrix3 linear, Vector3 translation, Matrix3 normal)
+        : linear{ linear }, translation{ translation }, normal{ normal }
+    {
+    }
+
+    Vector3 apply(Vector3 v) const override
+    {
+        v = linear.apply(v);
+        v.add(translation);
+        return v;
+    }
+
+    Vector3 applyNormal(Vector3 n) const override
+    {
+        return normal.apply(n);
+    }
+
+    void applyBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        linear.applyBatch(x, y, z);
+        x = x + Float4{ (float) translation.x };
+        y = y + Float4{ (float) translation.y };
+        z = z + Float4{ (float) translation.z };
+    }
+
+    void applyNormalBatch(Float4& x, Float4& y, Float4& z) const override
+    {
+        normal.applyBatch(x, y, z);
+    }
+
+    Matrix4 toMatrix() const override
+    {
+        return *this;
+    }
+
+    // this = this * other, so other is applied first
+    void mul(const Matrix4& other)
+    {
+        translation.add(linear.apply(other.translation));
+        linear.mul(other.linear);
+        normal.mul(other.normal);
+    }
+
+    const Matrix3& getLinear() const
+    {
+        return linear;
+    }
+
+    Vector3 getTranslation() const
+    {
+        return translation;
+    }
+
+    const Matrix3& getNormal() const
+    {
+        return normal;
+    }
+private:
+    Matrix3 linear;
+    Vector3 translation;
+    Matrix3 normal;
+};
+
+inline Matrix4 Transform::toMatrix() const
+{
+    Vector3 origin = apply(Vector3{ 0.0, 0.0, 0.0 });
+    Vector3 axes[3] = { Vector3{ 1.0, 0.0, 0.0 }, Vector3{ 0.0, 1.0, 0.0 }, Vector3{ 0.0, 0.0, 1.0 } };
+    Vector3 columns[3];
+    Vector3 normalColumns[3];
+    for (int i = 0; i < 3; i++)
+    {
+        columns[i] = apply(axes[i]);
+        columns[i].sub(origin);
+        normalColumns[i] = applyNormal(axes[i]);
+    }
+    return Matrix4
+    {
+        Matrix3{ columns[0], columns[1], columns[2] },
+        origin,
+        Matrix3{ normalColumns[0], normalColumns[1], normalColumns[2] }
+    };
+}
+
+inline Matrix4 Combined::toMatrix() const
+{
+    Matrix4 result;
+    for (int i = 0; i < chain.size(); i++)
+    {
+        Matrix4 link = chain[i]->toMatrix();
+        link.mul(result);
+        result = link;
+    }
+    return result;
+}
+
 #endif
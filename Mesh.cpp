@@ -1,4 +1,7 @@
 #include "Mesh.hpp"
+#include "ObjLoader.hpp"
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
 
 Vertex::Vertex()
     : Vertex{ {}, {}, {} }
@@ -36,47 +39,222 @@ bool WavefrontIndices::operator==(const WavefrontIndices& wi) const
 
 std::size_t WavefrontIndices::Hash::operator()(const WavefrontIndices& wi) const
 {
-    int hash = wi.v;
-    hash = 3 * hash + wi.vt;
-    hash = 3 * hash + wi.vn;
+    // Each index is spread by its own odd constant, then the bits are mixed
+    // so that nearby triples land far apart in power-of-two tables
+    uint64_t hash = (uint32_t) wi.v * 0x9E3779B97F4A7C15ull;
+    hash ^= (uint32_t) wi.vt * 0xC2B2AE3D27D4EB4Full;
+    hash ^= (uint32_t) wi.vn * 0x165667B19E3779F9ull;
+    hash ^= hash >> 32;
+    hash *= 0xD6E8FEB86659FD93ull;
+    hash ^= hash >> 32;
     return hash;
 }
 
-Mesh::Mesh() {}
+MeshStreams::MeshStreams()
+    : vertexCount{ 0 }, paddedVertexCount{ 0 }, x{ nullptr }, y{ nullptr }, z{ nullptr }, nx{ nullptr }, ny{ nullptr }, nz{ nullptr }, r{ nullptr }, g{ nullptr }, b{ nullptr }, u{ nullptr }, v{ nullptr },
+      faceCount{ 0 }, paddedFaceCount{ 0 }, faceX{ nullptr }, faceY{ nullptr }, faceZ{ nullptr }, triangleCount{ 0 }, triangles{ nullptr }, meshletCount{ 0 }, meshlets{ nullptr }
+{
+}
+
+void MeshStreams::build(const std::vector<Vertex>& vertices, const std::vector<Triangle>& triangles, const std::vector<Vector3>& faceNormals, const std::vector<Meshlet>& meshlets)
+{
+    vertexCount = vertices.size();
+    paddedVertexCount = (vertexCount + 3) & ~3;
+    faceCount = faceNormals.size();
+    paddedFaceCount = (faceCount + 3) & ~3;
+    storage.assign(11 * paddedVertexCount + 3 * paddedFaceCount, 0.0f);
+
+    float* arrays[14];
+    for (int i = 0; i < 11; i++)
+        arrays[i] = storage.data() + i * paddedVertexCount;
+    for (int i = 0; i < 3; i++)
+        arrays[11 + i] = storage.data() + 11 * paddedVertexCount + i * paddedFaceCount;
+    bounds = Bounds{ Vector3{ 0.0, 0.0, 0.0 }, Vector3{ 0.0, 0.0, 0.0 } };
+    if (vertexCount > 0)
+        bounds = Bounds{ vertices[0].xyz, vertices[0].xyz };
+    for (int i = 0; i < vertexCount; i++)
+    {
+        const Vertex& vertex = vertices[i];
+        arrays[0][i] = vertex.xyz.x;
+        arrays[1][i] = vertex.xyz.y;
+        arrays[2][i] = vertex.xyz.z;
+        arrays[3][i] = vertex.normal.x;
+        arrays[4][i] = vertex.normal.y;
+        arrays[5][i] = vertex.normal.z;
+        arrays[6][i] = vertex.rgb.x;
+        arrays[7][i] = vertex.rgb.y;
+        arrays[8][i] = vertex.rgb.z;
+        arrays[9][i] = vertex.uv.x;
+        arrays[10][i] = vertex.uv.y;
+        bounds.min = Vector3{ fmin(bounds.min.x, vertex.xyz.x), fmin(bounds.min.y, vertex.xyz.y), fmin(bounds.min.z, vertex.xyz.z) };
+        bounds.max = Vector3{ fmax(bounds.max.x, vertex.xyz.x), fmax(bounds.max.y, vertex.xyz.y), fmax(bounds.max.z, vertex.xyz.z) };
+    }
+    for (int i = 0; i < faceCount; i++)
+    {
+        arrays[11][i] = faceNormals[i].x;
+        arrays[12][i] = faceNormals[i].y;
+        arrays[13][i] = faceNormals[i].z;
+    }
+
+    x = arrays[0];
+    y = arrays[1];
+    z = arrays[2];
+    nx = arrays[3];
+    ny = arrays[4];
+    nz = arrays[5];
+    r = arrays[6];
+    g = arrays[7];
+    b = arrays[8];
+    u = arrays[9];
+    v = arrays[10];
+    faceX = arrays[11];
+    faceY = arrays[12];
+    faceZ = arrays[13];
+    triangleCount = triangles.size();
+    this->triangles = triangles.data();
+    meshletCount = meshlets.size();
+    this->meshlets = meshlets.data();
+}
+
+Mesh::Mesh()
+    : materialized{ true }, streamsDirty{ true }
+{
+}
 
 Mesh::Mesh(std::vector<Vertex> vertices, std::vector<Triangle> triangles, Shading shading)
+    : materialized{ true }, streamsDirty{ true }
 {
-    this->vertices = vertices;
-    this->triangles = triangles;
+    this->vertices = std::move(vertices);
+    this->triangles = std::move(triangles);
     computeNormals(shading);
 }
 
+Mesh::Mesh(const Mesh& mesh)
+    : materialized{ true }, streamsDirty{ true }
+{
+    *this = mesh;
+}
+
+Mesh& Mesh::operator=(const Mesh& mesh)
+{
+    if (this == &mesh)
+        return *this;
+    vertices = mesh.vertices;
+    triangles = mesh.triangles;
+    faceNormals = mesh.faceNormals;
+    meshlets = mesh.meshlets;
+    materialized = mesh.materialized;
+    mapping = mesh.mapping;
+    // Streams of a mapped mesh point into the shared mapping and can be
+    // copied as they are. Built ones point at the other mesh's memory
+    if (mapping && !mesh.streamsDirty)
+    {
+        streams = mesh.streams;
+        streamsDirty = false;
+    }
+    else
+        streamsDirty = true;
+    return *this;
+}
+
+void Mesh::materialize() const
+{
+    if (materialized)
+        return;
+    materialized = true;
+    vertices.resize(streams.vertexCount);
+    for (int i = 0; i < streams.vertexCount; i++)
+        vertices[i] = Vertex
+        {
+            Vector3{ streams.x[i], streams.y[i], streams.z[i] },
+            Vector3{ streams.r[i], streams.g[i], streams.b[i] },
+            Vector2{ streams.u[i], streams.v[i] },
+            Vector3{ streams.nx[i], streams.ny[i], streams.nz[i] }
+        };
+    triangles.assign(streams.triangles, streams.triangles + streams.triangleCount);
+    faceNormals.resize(streams.faceCount);
+    for (int i = 0; i < streams.faceCount; i++)
+        faceNormals[i] = Vector3{ streams.faceX[i], streams.faceY[i], streams.faceZ[i] };
+    meshlets.assign(streams.meshlets, streams.meshlets + streams.meshletCount);
+}
+
 void Mesh::invertNormals()
 {
+    materialize();
+    streamsDirty = true;
     for (int i = 0; i < vertices.size(); i++)
         vertices[i].normal.scl(-1.0);
 
     for (int i = 0; i < faceNormals.size(); i++)
         faceNormals[i].scl(-1.0);
+    for (Meshlet& meshlet : meshlets)
+        meshlet.coneAxis.scl(-1.0);
 }
 
 std::vector<Vertex>& Mesh::getVertices()
 {
+    materialize();
+    streamsDirty = true;
+    meshlets.clear();
     return vertices;
 }
 
 std::vector<Triangle>& Mesh::getTriangles()
 {
+    materialize();
+    streamsDirty = true;
+    meshlets.clear();
     return triangles;
 }
 
 std::vector<Vector3>& Mesh::getFaceNormals()
 {
+    materialize();
+    streamsDirty = true;
+    meshlets.clear();
+    return faceNormals;
+}
+
+const std::vector<Vertex>& Mesh::getVertices() const
+{
+    materialize();
+    return vertices;
+}
+
+const std::vector<Triangle>& Mesh::getTriangles() const
+{
+    materialize();
+    return triangles;
+}
+
+const std::vector<Vector3>& Mesh::getFaceNormals() const
+{
+    materialize();
     return faceNormals;
 }
 
+const MeshStreams& Mesh::getStreams()
+{
+    if (streamsDirty)
+    {
+        streams.build(vertices, triangles, faceNormals, meshlets);
+        streamsDirty = false;
+        // Nothing points into the cache any more
+        mapping.reset();
+    }
+    return streams;
+}
+
+Bounds Mesh::getBounds()
+{
+    return getStreams().bounds;
+}
+
 void Mesh::computeNormals(Shading shading)
 {
+    materialize();
+    streamsDirty = true;
+    meshlets.clear();
     faceNormals.clear();
     for (int i = 0; i < triangles.size(); i++)
     {
@@ -131,90 +309,400 @@ void Mesh::computeNormals(Shading shading)
 
 Mesh* Mesh::loadFromFile(std::string objFile, Shading shading)
 {
-    std::vector<Vector3> v;
-    std::vector<Vector2> vt;
-    std::vector<Vector3> vn;
-    std::vector<WavefrontIndices> wavefrontIndices;
-    std::ifstream input{ objFile };
-    for (std::string line; getline(input, line);)
+    std::string cacheFile = objFile + ".meshcache";
+    Mesh* mesh = MeshCache::load(cacheFile, objFile, shading);
+    if (mesh != nullptr)
+        return mesh;
+
+    mesh = ObjLoader::load(objFile, shading);
+    mesh->optimizeVertexCache();
+    mesh->buildMeshlets();
+    MeshCache::save(*mesh, cacheFile, objFile, shading);
+    return mesh;
+}
+
+void Mesh::optimizeVertexCache()
+{
+    materialize();
+    streamsDirty = true;
+    meshlets.clear();
+    int vertexCount = vertices.size();
+    int triangleCount = triangles.size();
+    if (triangleCount == 0)
+        return;
+
+    std::vector<int> adjacencyStart;
+    std::vector<int> adjacency;
+    buildAdjacency(adjacencyStart, adjacency);
+    std::vector<int> remaining(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+        remaining[v] = adjacencyStart[v + 1] - adjacencyStart[v];
+
+    // A vertex scores higher the more recently it was used, with the last
+    // triangle's three equal so the strip doesn't double back, and the
+    // fewer triangles it has left, so none get stranded
+    const int cacheSize = 32;
+    auto vertexScore = [&](int cachePosition, int valence)
+    {
+        if (valence == 0)
+            return -1.0;
+        double score = 0.0;
+        if (cachePosition >= 0)
+            score = cachePosition < 3 ? 0.75 : pow(1.0 - (cachePosition - 3) / (double) (cacheSize - 3), 1.5);
+        return score + 2.0 / sqrt((double) valence);
+    };
+
+    std::vector<int> cachePositions(vertexCount, -1);
+    std::vector<double> vertexScores(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(-1, remaining[v]);
+    std::vector<double> triangleScores(triangleCount);
+    for (int i = 0; i < triangleCount; i++)
+        triangleScores[i] = vertexScores[triangles[i].v0] + vertexScores[triangles[i].v1] + vertexScores[triangles[i].v2];
+    std::vector<bool> emitted(triangleCount, false);
+
+    std::vector<int> order;
+    order.reserve(triangleCount);
+    std::vector<int> cache;
+    std::vector<int> nextCache;
+    int bestTriangle = 0;
+    for (int i = 1; i < triangleCount; i++)
+        if (triangleScores[i] > triangleScores[bestTriangle])
+            bestTriangle = i;
+    // Where to look for a fresh start once nothing in the cache is left
+    int scanStart = 0;
+
+    while (bestTriangle >= 0)
     {
-        std::istringstream iss{ line };
-        std::string tag;
-        iss >> tag;
-        if (tag == "v")
+        const Triangle& triangle = triangles[bestTriangle];
+        emitted[bestTriangle] = true;
+        order.push_back(bestTriangle);
+        int corners[3] = { triangle.v0, triangle.v1, triangle.v2 };
+
+        // The triangle's vertices move to the front of the cache
+        nextCache.assign(corners, corners + 3);
+        for (int v : cache)
+            if (v != corners[0] && v != corners[1] && v != corners[2])
+                nextCache.push_back(v);
+        for (int v : corners)
         {
-            double x, y, z;
-            iss >> x >> y >> z;
-            v.push_back(Vector3{ x, y, z });
+            int* around = &adjacency[adjacencyStart[v]];
+            int count = remaining[v];
+            for (int i = 0; i < count; i++)
+                if (around[i] == bestTriangle)
+                {
+                    around[i] = around[count - 1];
+                    break;
+                }
+            remaining[v]--;
         }
-        else if (tag == "vt")
+
+        // Rescore everything that was or is in the cache, then pick the
+        // best triangle that touches it
+        for (int i = 0; i < nextCache.size(); i++)
         {
-            double u, v;
-            iss >> u >> v;
-            vt.push_back(Vector2{ u, v });
+            int v = nextCache[i];
+            cachePositions[v] = i < cacheSize ? i : -1;
+            vertexScores[v] = vertexScore(cachePositions[v], remaining[v]);
         }
-        else if (tag == "vn")
+        bestTriangle = -1;
+        double bestScore = -1.0;
+        for (int i = 0; i < nextCache.size() && i < cacheSize; i++)
         {
-            double x, y, z;
-            iss >> x >> y >> z;
-            vn.push_back(Vector3{ x, y, z });
+            int v = nextCache[i];
+            for (int j = adjacencyStart[v]; j < adjacencyStart[v] + remaining[v]; j++)
+            {
+                int t = adjacency[j];
+                double score = vertexScores[triangles[t].v0] + vertexScores[triangles[t].v1] + vertexScores[triangles[t].v2];
+                triangleScores[t] = score;
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = t;
+                }
+            }
         }
-        else if (tag == "f")
+        if (nextCache.size() > cacheSize)
+            nextCache.resize(cacheSize);
+        std::swap(cache, nextCache);
+
+        if (bestTriangle < 0)
         {
-            auto setIndices = [](std::string indicesString, WavefrontIndices& wi)
-            {
-                int slash = indicesString.find("/");
-                std::string num0 = indicesString.substr(0, slash);
-                indicesString = indicesString.substr(slash + 1);
-                slash = indicesString.find("/");
-                std::string num1 = indicesString.substr(0, slash);
-                std::string num2 = indicesString.substr(slash + 1);
-
-                wi.v = std::stoi(num0) - 1;
-                wi.vt = std::stoi(num1) - 1;
-                wi.vn = std::stoi(num2) - 1;
-            };
-            std::string indices0, indices1, indices2;
-            iss >> indices0 >> indices1 >> indices2;
-            WavefrontIndices wi0, wi1, wi2;
-            setIndices(indices0, wi0);
-            setIndices(indices1, wi1);
-            setIndices(indices2, wi2);
-            wavefrontIndices.push_back(wi0);
-            wavefrontIndices.push_back(wi1);
-            wavefrontIndices.push_back(wi2);
+            while (scanStart < triangleCount && emitted[scanStart])
+                scanStart++;
+            if (scanStart < triangleCount)
+                bestTriangle = scanStart;
         }
     }
 
-    std::unordered_map<WavefrontIndices, int, WavefrontIndices::Hash> indexMap;
+    reorder(order);
+}
 
-    int index = 0;
-    for (int i = 0; i < wavefrontIndices.size(); i++)
+void Mesh::buildMeshlets(int maxVertices, int maxTriangles, double maxConeAngle)
+{
+    materialize();
+    streamsDirty = true;
+    meshlets.clear();
+    int vertexCount = vertices.size();
+    int triangleCount = triangles.size();
+    if (triangleCount == 0)
+        return;
+    if (faceNormals.size() != triangleCount)
+        computeNormals(Shading::KEEP_NORMALS);
+
+    std::vector<int> adjacencyStart;
+    std::vector<int> adjacency;
+    buildAdjacency(adjacencyStart, adjacency);
+
+    auto centroid = [this](int t)
     {
-        WavefrontIndices wi = wavefrontIndices.at(i);
-        auto found = indexMap.find(wi);
-        if (found == indexMap.end())
-            indexMap.insert(std::make_pair(wi, index++));
+        Vector3 sum = vertices[triangles[t].v0].xyz;
+        sum.add(vertices[triangles[t].v1].xyz);
+        sum.add(vertices[triangles[t].v2].xyz);
+        sum.scl(1.0 / 3.0);
+        return sum;
+    };
+
+    // Degenerate triangles have no normal and go with anything
+    auto hasNormal = [this](int t)
+    {
+        return std::isfinite(faceNormals[t].x);
+    };
+
+    // Each meshlet grows from the first triangle not taken yet, adding the
+    // neighboring triangle that brings in the fewest new vertices and, of
+    // those, the one closest to facing the average way. Triangles and
+    // vertices are marked with the meshlet that last took or considered them
+    std::vector<bool> taken(triangleCount, false);
+    std::vector<int> triangleMeshlet(triangleCount, -1);
+    std::vector<int> vertexMeshlet(vertexCount, -1);
+    std::vector<int> candidates;
+    std::vector<int> order;
+    order.reserve(triangleCount);
+    std::vector<int> meshletSizes;
+    double minConeCos = cos(maxConeAngle);
+
+    // Triangles not taken yet around every vertex. The next meshlet starts
+    // from the most hemmed in triangle the last one left at its edge, so
+    // no small islands are left behind
+    std::vector<int> freeAround(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+        freeAround[v] = adjacencyStart[v + 1] - adjacencyStart[v];
+    int scanStart = 0;
+    while (true)
+    {
+        int seed = -1;
+        int seedFree = 0;
+        for (int t : candidates)
+        {
+            if (taken[t])
+                continue;
+            int free = freeAround[triangles[t].v0] + freeAround[triangles[t].v1] + freeAround[triangles[t].v2];
+            if (seed < 0 || free < seedFree)
+            {
+                seed = t;
+                seedFree = free;
+            }
+        }
+        if (seed < 0)
+        {
+            while (scanStart < triangleCount && taken[scanStart])
+                scanStart++;
+            if (scanStart == triangleCount)
+                break;
+            seed = scanStart;
+        }
+
+        int meshlet = meshletSizes.size();
+        int meshletVertices = 0;
+        int meshletTriangles = 0;
+        Vector3 normalSum{ 0.0, 0.0, 0.0 };
+        Vector3 centroidSum{ 0.0, 0.0, 0.0 };
+        candidates.clear();
+        int next = seed;
+        while (next >= 0)
+        {
+            taken[next] = true;
+            order.push_back(next);
+            freeAround[triangles[next].v0]--;
+            freeAround[triangles[next].v1]--;
+            freeAround[triangles[next].v2]--;
+            meshletTriangles++;
+            if (hasNormal(next))
+                normalSum.add(faceNormals[next]);
+            centroidSum.add(centroid(next));
+            const Triangle& triangle = triangles[next];
+            for (int v : { triangle.v0, triangle.v1, triangle.v2 })
+            {
+                if (vertexMeshlet[v] == meshlet)
+                    continue;
+                vertexMeshlet[v] = meshlet;
+                meshletVertices++;
+                for (int i = adjacencyStart[v]; i < adjacencyStart[v + 1]; i++)
+                {
+                    int t = adjacency[i];
+                    if (!taken[t] && triangleMeshlet[t] != meshlet)
+                    {
+                        triangleMeshlet[t] = meshlet;
+                        candidates.push_back(t);
+                    }
+                }
+            }
+            if (meshletTriangles == maxTriangles)
+                break;
+
+            Vector3 axis = normalSum;
+            double axisLength = axis.len();
+            if (axisLength > 0.0)
+                axis.scl(1.0 / axisLength);
+            Vector3 middle = centroidSum;
+            middle.scl(1.0 / meshletTriangles);
+            next = -1;
+            int bestNewVertices = 4;
+            int bestFree = 0;
+            double bestDistance = 0.0;
+            int kept = 0;
+            for (int t : candidates)
+            {
+                if (taken[t])
+                    continue;
+                candidates[kept++] = t;
+                const Triangle& candidate = triangles[t];
+                int newVertices = (vertexMeshlet[candidate.v0] != meshlet) + (vertexMeshlet[candidate.v1] != meshlet) + (vertexMeshlet[candidate.v2] != meshlet);
+                if (meshletVertices + newVertices > maxVertices)
+                    continue;
+                double coneCos = axisLength > 0.0 && hasNormal(t) ? faceNormals[t].dot(axis) : 1.0;
+                if (coneCos < minConeCos)
+                    continue;
+                Vector3 offset = centroid(t);
+                offset.sub(middle);
+                double distance = offset.len2();
+                int free = freeAround[candidate.v0] + freeAround[candidate.v1] + freeAround[candidate.v2];
+                if (newVertices < bestNewVertices || (newVertices == bestNewVertices && (free < bestFree || (free == bestFree && distance < bestDistance))))
+                {
+                    next = t;
+                    bestNewVertices = newVertices;
+                    bestFree = free;
+                    bestDistance = distance;
+                }
+            }
+            candidates.resize(kept);
+        }
+        meshletSizes.push_back(meshletTriangles);
     }
 
-    std::vector<Vertex> vertices;
-    vertices.resize(indexMap.size());
-    for (auto it = indexMap.begin(); it != indexMap.end(); it++)
+    reorder(order);
+
+    // Bounds are worked out on the final order, each meshlet's sphere
+    // around the middle of its box
+    int triangleStart = 0;
+    for (int size : meshletSizes)
     {
-        WavefrontIndices wi = it->first;
-        vertices.at(it->second) = Vertex{ v.at(wi.v), Vector3{ 1.0, 1.0, 1.0 }, vt.at(wi.vt), vn.at(wi.vn) };
+        Meshlet meshlet;
+        meshlet.triangleStart = triangleStart;
+        meshlet.triangleCount = size;
+        triangleStart += size;
+
+        const Triangle& first = triangles[meshlet.triangleStart];
+        Vector3 min = vertices[first.v0].xyz;
+        Vector3 max = min;
+        Vector3 normalSum{ 0.0, 0.0, 0.0 };
+        for (int t = meshlet.triangleStart; t < triangleStart; t++)
+        {
+            for (int v : { triangles[t].v0, triangles[t].v1, triangles[t].v2 })
+            {
+                const Vector3& p = vertices[v].xyz;
+                min = Vector3{ fmin(min.x, p.x), fmin(min.y, p.y), fmin(min.z, p.z) };
+                max = Vector3{ fmax(max.x, p.x), fmax(max.y, p.y), fmax(max.z, p.z) };
+            }
+            if (hasNormal(t))
+                normalSum.add(faceNormals[t]);
+        }
+        meshlet.center = Vector3{ (min.x + max.x) * 0.5, (min.y + max.y) * 0.5, (min.z + max.z) * 0.5 };
+        meshlet.radius = 0.0;
+        for (int t = meshlet.triangleStart; t < triangleStart; t++)
+            for (int v : { triangles[t].v0, triangles[t].v1, triangles[t].v2 })
+            {
+                Vector3 offset = vertices[v].xyz;
+                offset.sub(meshlet.center);
+                meshlet.radius = fmax(meshlet.radius, offset.len());
+            }
+
+        meshlet.coneAxis = normalSum;
+        meshlet.coneCos = -1.0;
+        double axisLength = normalSum.len();
+        if (axisLength > 0.0)
+        {
+            meshlet.coneAxis.scl(1.0 / axisLength);
+            meshlet.coneCos = 1.0;
+            for (int t = meshlet.triangleStart; t < triangleStart; t++)
+                if (hasNormal(t))
+                    meshlet.coneCos = fmin(meshlet.coneCos, faceNormals[t].dot(meshlet.coneAxis));
+        }
+        meshlets.push_back(meshlet);
     }
+}
+
+const std::vector<Meshlet>& Mesh::getMeshlets() const
+{
+    materialize();
+    return meshlets;
+}
+
+void Mesh::buildAdjacency(std::vector<int>& adjacencyStart, std::vector<int>& adjacency) const
+{
+    int vertexCount = vertices.size();
+    adjacencyStart.assign(vertexCount + 1, 0);
+    for (const Triangle& triangle : triangles)
+        for (int v : { triangle.v0, triangle.v1, triangle.v2 })
+            adjacencyStart[v + 1]++;
+    for (int v = 0; v < vertexCount; v++)
+        adjacencyStart[v + 1] += adjacencyStart[v];
+    adjacency.resize(triangles.size() * 3);
+    std::vector<int> filled(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (int i = 0; i < triangles.size(); i++)
+        for (int v : { triangles[i].v0, triangles[i].v1, triangles[i].v2 })
+            adjacency[filled[v]++] = i;
+}
 
-    std::vector<Triangle> triangles;
-    for (int i = 0; i < wavefrontIndices.size(); i += 3)
+void Mesh::reorder(const std::vector<int>& order)
+{
+    int vertexCount = vertices.size();
+    int triangleCount = triangles.size();
+    std::vector<int> newIndex(vertexCount, -1);
+    std::vector<Vertex> newVertices;
+    newVertices.reserve(vertexCount);
+    auto renumber = [&](int v)
     {
-        WavefrontIndices wi0 = wavefrontIndices.at(i);
-        WavefrontIndices wi1 = wavefrontIndices.at(i + 1);
-        WavefrontIndices wi2 = wavefrontIndices.at(i + 2);
-        triangles.push_back(Triangle{ indexMap.at(wi0), indexMap.at(wi1), indexMap.at(wi2) });
+        if (newIndex[v] < 0)
+        {
+            newIndex[v] = newVertices.size();
+            newVertices.push_back(vertices[v]);
+        }
+        return newIndex[v];
+    };
+    std::vector<Triangle> newTriangles;
+    newTriangles.reserve(triangleCount);
+    for (int t : order)
+    {
+        int v0 = renumber(triangles[t].v0);
+        int v1 = renumber(triangles[t].v1);
+        int v2 = renumber(triangles[t].v2);
+        newTriangles.push_back(Triangle{ v0, v1, v2 });
     }
+    for (int v = 0; v < vertexCount; v++)
+        if (newIndex[v] < 0)
+            newVertices.push_back(vertices[v]);
 
-    return new Mesh{ vertices, triangles, shading };
+    if (faceNormals.size() == triangleCount)
+    {
+        std::vector<Vector3> newFaceNormals(triangleCount);
+        for (int i = 0; i < triangleCount; i++)
+            newFaceNormals[i] = faceNormals[order[i]];
+        faceNormals = std::move(newFaceNormals);
+    }
+    vertices = std::move(newVertices);
+    triangles = std::move(newTriangles);
 }
 
 Mesh* Mesh::generateUVSphere(int rings, int segments, Shading shading)
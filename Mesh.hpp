@@ -4,6 +4,7 @@
 #include "Math.hpp"
 
 #include <vector>
+#include <memory>
 #include <unordered_map>
 #include <string>
 #include <fstream>
@@ -43,6 +44,59 @@ struct WavefrontIndices
     int v, vt, vn;
 };
 
+class MappedFile;
+
+// A run of consecutive triangles of a mesh that can be culled as a whole.
+// The sphere holds all their vertices, and every face normal is within the
+// angle whose cosine is coneCos of coneAxis. A coneCos of -1 means the
+// normals can point any way
+struct Meshlet
+{
+    int triangleStart;
+    int triangleCount;
+    Vector3 center;
+    double radius;
+    Vector3 coneAxis;
+    double coneCos;
+};
+
+// Axis-aligned box around a mesh's vertices
+struct Bounds
+{
+    Vector3 min;
+    Vector3 max;
+};
+
+// Structure-of-arrays copy of a mesh for the batched vertex stage, with its
+// triangles and meshlets. Every float array is padded with zeros to a
+// multiple of four entries. The arrays live in storage when built from a
+// mesh, or point straight into a mapped mesh cache
+struct MeshStreams
+{
+    MeshStreams();
+
+    void build(const std::vector<Vertex>& vertices, const std::vector<Triangle>& triangles, const std::vector<Vector3>& faceNormals, const std::vector<Meshlet>& meshlets);
+
+    int vertexCount;
+    int paddedVertexCount;
+    const float* x, * y, * z;
+    const float* nx, * ny, * nz;
+    const float* r, * g, * b;
+    const float* u, * v;
+
+    int faceCount;
+    int paddedFaceCount;
+    const float* faceX, * faceY, * faceZ;
+    int triangleCount;
+    const Triangle* triangles;
+    int meshletCount;
+    const Meshlet* meshlets;
+
+    Bounds bounds;
+
+    std::vector<float> storage;
+};
+
 class Mesh
 {
 public:
@@ -53,21 +107,71 @@ public:
 
     Mesh();
     Mesh(std::vector<Vertex> vertices, std::vector<Triangle> triangles, Shading shading);
+    Mesh(const Mesh& mesh);
+    Mesh& operator=(const Mesh& mesh);
 
     void invertNormals();
     void computeNormals(Shading shading);
 
+    // Reorders triangles so that ones sharing vertices are drawn close
+    // together (Tom Forsyth's linear-speed vertex cache optimization), then
+    // renumbers vertices in the order the new triangle list first uses
+    // them. The mesh looks the same, but the per-triangle stages read the
+    // vertex streams mostly in order instead of all over memory
+    void optimizeVertexCache();
+
+    // Splits the triangles into meshlets of at most maxVertices vertices and
+    // maxTriangles triangles, grown greedily across shared vertices while
+    // their face normals stay within maxConeAngle of the average. Triangles
+    // are reordered so every meshlet is a consecutive run, and vertices are
+    // renumbered in first use, so a meshlet's own vertices sit together.
+    // The renderer then skips meshlets outside the view or facing away
+    // before transforming anything. Editing the mesh drops them
+    void buildMeshlets(int maxVertices = 64, int maxTriangles = 124, double maxConeAngle = radians(45.0));
+    const std::vector<Meshlet>& getMeshlets() const;
+
+    // The non-const accessors assume the mesh is about to be edited and
+    // mark the streams for rebuilding, and drop the meshlets
     std::vector<Vertex>& getVertices();
     std::vector<Triangle>& getTriangles();
     std::vector<Vector3>& getFaceNormals();
-
-    static Mesh loadFromFile(std::string objFile, Shading shading);
-    static Mesh generateUVSphere(int rings, int segments, Shading shading);
+    const std::vector<Vertex>& getVertices() const;
+    const std::vector<Triangle>& getTriangles() const;
+    const std::vector<Vector3>& getFaceNormals() const;
+
+    const MeshStreams& getStreams();
+    Bounds getBounds();
+
+    // Loads through a binary cache next to the OBJ file, objFile +
+    // ".meshcache", which is written on the first load and mapped on later
+    // ones for as long as the OBJ and shading stay the same. See MeshCache.
+    // The cache holds the mesh already optimized for the vertex cache and
+    // split into meshlets
+    static Mesh* loadFromFile(std::string objFile, Shading shading);
+    static Mesh* generateUVSphere(int rings, int segments, Shading shading);
 private:
-
-    std::vector<Vertex> vertices;
-    std::vector<Triangle> triangles;
-    std::vector<Vector3> faceNormals;
+    friend class MeshCache;
+
+    // A mesh loaded from a cache renders straight from the mapping. The
+    // vectors below are only filled in from it, at float precision, the
+    // first time any accessor asks for them, which const accessors do too
+    mutable std::vector<Vertex> vertices;
+    mutable std::vector<Triangle> triangles;
+    mutable std::vector<Vector3> faceNormals;
+    mutable std::vector<Meshlet> meshlets;
+    std::shared_ptr<const MappedFile> mapping;
+    mutable bool materialized;
+
+    MeshStreams streams;
+    bool streamsDirty;
+
+    void materialize() const;
+
+    // Triangles around every vertex, as offsets into one shared array
+    void buildAdjacency(std::vector<int>& adjacencyStart, std::vector<int>& adjacency) const;
+    // Puts the triangles in the given order and renumbers vertices in the
+    // order it first uses them. Unused vertices keep their order at the end
+    void reorder(const std::vector<int>& order);
 };
 
 #endif
@@ -0,0 +1,195 @@
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::is_trivially_copyable<Triangle>::value && std::is_trivially_copyable<Meshlet>::value, "cached triangles and meshlets are used straight from the mapping");
+
+Mesh* MeshCache::load(std::string cacheFile, std::string sourceFile, Mesh::Shading shading)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!getStamp(sourceFile, sourceSize, sourceTime))
+        return nullptr;
+
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(cacheFile);
+    if (!file->isOpen() || file->getSize() < sizeof(Header))
+        return nullptr;
+    Header header;
+    std::memcpy(&header, file->getData(), sizeof(Header));
+    if (header.magic != Header::magicValue || header.version != Header::currentVersion ||
+        header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+        header.shading != (uint32_t) shading || header.fileSize != file->getSize())
+        return nullptr;
+
+    // Sections must lie inside the file, aligned for SIMD loads, and padded
+    // for the four lanes the renderer reads at a time, so a damaged header
+    // can't send the renderer outside the mapping. Offsets are compared
+    // against what is left of the file so that nothing can wrap around
+    auto inside = [&](uint64_t offset, uint64_t bytes)
+    {
+        return offset % 16 == 0 && bytes <= header.fileSize && offset <= header.fileSize - bytes;
+    };
+    uint64_t vertexBytes = 11 * alignOffset(header.paddedVertexCount * sizeof(float));
+    uint64_t triangleBytes = (uint64_t) header.triangleCount * sizeof(Triangle);
+    uint64_t faceBytes = 3 * alignOffset(header.paddedFaceCount * sizeof(float));
+    uint64_t meshletBytes = (uint64_t) header.meshletCount * sizeof(Meshlet);
+    uint64_t paddedTriangleCount = ((uint64_t) header.triangleCount + 3) & ~(uint64_t) 3;
+    if (!inside(header.vertexOffset, vertexBytes) || !inside(header.triangleOffset, triangleBytes) ||
+        !inside(header.faceOffset, faceBytes) || !inside(header.meshletOffset, meshletBytes) ||
+        header.paddedVertexCount % 4 != 0 || header.paddedFaceCount % 4 != 0 ||
+        header.paddedVertexCount < header.vertexCount || header.paddedFaceCount < header.faceCount ||
+        header.paddedFaceCount < paddedTriangleCount || header.faceCount < header.triangleCount)
+        return nullptr;
+    // And so must every vertex a triangle refers to
+    const Triangle* triangles = reinterpret_cast<const Triangle*>(file->getData() + header.triangleOffset);
+    for (uint64_t i = 0; i < header.triangleCount; i++)
+        if ((uint32_t) triangles[i].v0 >= header.vertexCount || (uint32_t) triangles[i].v1 >= header.vertexCount ||
+            (uint32_t) triangles[i].v2 >= header.vertexCount)
+            return nullptr;
+    // And every triangle a meshlet refers to
+    const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(file->getData() + header.meshletOffset);
+    for (uint64_t i = 0; i < header.meshletCount; i++)
+        if (meshlets[i].triangleStart < 0 || meshlets[i].triangleCount < 0 ||
+            (uint32_t) meshlets[i].triangleStart + (uint64_t) meshlets[i].triangleCount > header.triangleCount)
+            return nullptr;
+
+    Mesh* mesh = new Mesh{};
+    MeshStreams& streams = mesh->streams;
+    const char* data = file->getData();
+    auto vertexArray = [&](int index)
+    {
+        return reinterpret_cast<const float*>(data + header.vertexOffset + index * alignOffset(header.paddedVertexCount * sizeof(float)));
+    };
+    auto faceArray = [&](int index)
+    {
+        return reinterpret_cast<const float*>(data + header.faceOffset + index * alignOffset(header.paddedFaceCount * sizeof(float)));
+    };
+    streams.vertexCount = header.vertexCount;
+    streams.paddedVertexCount = header.paddedVertexCount;
+    streams.x = vertexArray(0);
+    streams.y = vertexArray(1);
+    streams.z = vertexArray(2);
+    streams.nx = vertexArray(3);
+    streams.ny = vertexArray(4);
+    streams.nz = vertexArray(5);
+    streams.r = vertexArray(6);
+    streams.g = vertexArray(7);
+    streams.b = vertexArray(8);
+    streams.u = vertexArray(9);
+    streams.v = vertexArray(10);
+    streams.faceCount = header.faceCount;
+    streams.paddedFaceCount = header.paddedFaceCount;
+    streams.faceX = faceArray(0);
+    streams.faceY = faceArray(1);
+    streams.faceZ = faceArray(2);
+    streams.triangleCount = header.triangleCount;
+    streams.triangles = triangles;
+    streams.meshletCount = header.meshletCount;
+    streams.meshlets = meshlets;
+    streams.bounds = Bounds
+    {
+        Vector3{ header.boundsMin[0], header.boundsMin[1], header.boundsMin[2] },
+        Vector3{ header.boundsMax[0], header.boundsMax[1], header.boundsMax[2] }
+    };
+    mesh->mapping = file;
+    mesh->materialized = false;
+    mesh->streamsDirty = false;
+    return mesh;
+}
+
+bool MeshCache::save(Mesh& mesh, std::string cacheFile, std::string sourceFile, Mesh::Shading shading)
+{
+    Header header{};
+    if (!getStamp(sourceFile, header.sourceSize, header.sourceTime))
+        return false;
+
+    const MeshStreams& streams = mesh.getStreams();
+    header.magic = Header::magicValue;
+    header.version = Header::currentVersion;
+    header.shading = (uint32_t) shading;
+    header.vertexCount = streams.vertexCount;
+    header.paddedVertexCount = streams.paddedVertexCount;
+    header.triangleCount = streams.triangleCount;
+    header.faceCount = streams.faceCount;
+    header.paddedFaceCount = streams.paddedFaceCount;
+    header.meshletCount = streams.meshletCount;
+    const double boundsMin[3] = { streams.bounds.min.x, streams.bounds.min.y, streams.bounds.min.z };
+    const double boundsMax[3] = { streams.bounds.max.x, streams.bounds.max.y, streams.bounds.max.z };
+    for (int i = 0; i < 3; i++)
+    {
+        header.boundsMin[i] = (float) boundsMin[i];
+        header.boundsMax[i] = (float) boundsMax[i];
+    }
+    uint64_t vertexArrayBytes = alignOffset(streams.paddedVertexCount * sizeof(float));
+    uint64_t faceArrayBytes = alignOffset(streams.paddedFaceCount * sizeof(float));
+    header.vertexOffset = alignOffset(sizeof(Header));
+    header.triangleOffset = header.vertexOffset + 11 * vertexArrayBytes;
+    header.faceOffset = alignOffset(header.triangleOffset + (uint64_t) streams.triangleCount * sizeof(Triangle));
+    header.meshletOffset = alignOffset(header.faceOffset + 3 * faceArrayBytes);
+    header.fileSize = header.meshletOffset + (uint64_t) streams.meshletCount * sizeof(Meshlet);
+
+    std::string temporaryFile = cacheFile + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream output{ temporaryFile, std::ios::binary };
+    uint64_t written = 0;
+    auto write = [&](const void* data, uint64_t bytes)
+    {
+        output.write(static_cast<const char*>(data), bytes);
+        written += bytes;
+    };
+    auto padTo = [&](uint64_t offset)
+    {
+        static const char zeros[64] = {};
+        while (written < offset)
+            write(zeros, std::min<uint64_t>(sizeof(zeros), offset - written));
+    };
+
+    write(&header, sizeof(Header));
+    const float* vertexArrays[] = { streams.x, streams.y, streams.z, streams.nx, streams.ny, streams.nz, streams.r, streams.g, streams.b, streams.u, streams.v };
+    for (int i = 0; i < 11; i++)
+    {
+        padTo(header.vertexOffset + i * vertexArrayBytes);
+        write(vertexArrays[i], streams.paddedVertexCount * sizeof(float));
+    }
+    padTo(header.triangleOffset);
+    write(streams.triangles, (uint64_t) streams.triangleCount * sizeof(Triangle));
+    const float* faceArrays[] = { streams.faceX, streams.faceY, streams.faceZ };
+    for (int i = 0; i < 3; i++)
+    {
+        padTo(header.faceOffset + i * faceArrayBytes);
+        write(faceArrays[i], streams.paddedFaceCount * sizeof(float));
+    }
+    padTo(header.meshletOffset);
+    write(streams.meshlets, (uint64_t) streams.meshletCount * sizeof(Meshlet));
+    padTo(header.fileSize);
+    output.close();
+
+    if (!output || std::rename(temporaryFile.c_str(), cacheFile.c_str()) != 0)
+    {
+        std::remove(temporaryFile.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::getStamp(std::string file, uint64_t& size, int64_t& time)
+{
+    struct stat info;
+    if (stat(file.c_str(), &info) != 0)
+        return false;
+    size = info.st_size;
+    time = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+uint64_t MeshCache::alignOffset(uint64_t offset)
+{
+    return (offset + 63) & ~(uint64_t) 63;
+}
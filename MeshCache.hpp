@@ -0,0 +1,62 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <string>
+
+// Binary mesh files laid out exactly like MeshStreams, so a mesh can render
+// straight from a read-only mapping of one without parsing or copying. A
+// header is followed by the eleven vertex arrays, the triangles, the three
+// face normal arrays and the meshlets, each starting on a 64-byte boundary.
+// Every
+// file records the size and modification time of the file it was built
+// from and the shading it was built with, and is only used while those
+// still match. Data is stored in the byte order of the machine that wrote
+// it, which the header's magic number checks
+class MeshCache
+{
+public:
+    // nullptr if the cache is missing, from another format version, or out
+    // of date with sourceFile
+    static Mesh* load(std::string cacheFile, std::string sourceFile, Mesh::Shading shading);
+    // Writes to a temporary file that is then renamed over cacheFile, so
+    // processes loading at the same time never see half a file. False if
+    // sourceFile is missing or the cache couldn't be written
+    static bool save(Mesh& mesh, std::string cacheFile, std::string sourceFile, Mesh::Shading shading);
+private:
+    struct Header
+    {
+        static const uint32_t magicValue = 0x4853454D; // "MESH"
+        static const uint32_t currentVersion = 3;
+
+        uint32_t magic;
+        uint32_t version;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint32_t shading;
+
+        uint32_t vertexCount;
+        uint32_t paddedVertexCount;
+        uint32_t triangleCount;
+        uint32_t faceCount;
+        uint32_t paddedFaceCount;
+        uint32_t meshletCount;
+        float boundsMin[3];
+        float boundsMax[3];
+
+        // Byte offsets from the start of the file
+        uint64_t vertexOffset;
+        uint64_t triangleOffset;
+        uint64_t faceOffset;
+        uint64_t meshletOffset;
+        uint64_t fileSize;
+    };
+
+    // Size and modification time in nanoseconds, false if the file is missing
+    static bool getStamp(std::string file, uint64_t& size, int64_t& time);
+    static uint64_t alignOffset(uint64_t offset);
+};
+
+#endif
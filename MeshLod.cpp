@@ -0,0 +1,59 @@
+#include "MeshLod.hpp"
+#include "MeshSimplifier.hpp"
+
+MeshLod::MeshLod(Mesh* mesh)
+    : mesh{ mesh }, bounds{ mesh->getBounds() }, errors{ 0.0 }
+{
+}
+
+void MeshLod::generate(int maxLevels, double reduction, int minTriangles)
+{
+    levels.clear();
+    errors.assign(1, 0.0);
+
+    MeshSimplifier simplifier{ *mesh };
+    int triangleCount = simplifier.getTriangleCount();
+    while (getLevelCount() < maxLevels)
+    {
+        int target = (int) (triangleCount * reduction);
+        if (target < minTriangles)
+            break;
+        simplifier.simplify(target);
+
+        // A level that barely differs from the last isn't worth keeping
+        int simplifiedCount = simplifier.getTriangleCount();
+        if (simplifiedCount > triangleCount - (triangleCount - target) / 2)
+            break;
+        levels.push_back(std::unique_ptr<Mesh>{ simplifier.createMesh() });
+        errors.push_back(simplifier.getError());
+        triangleCount = simplifiedCount;
+    }
+}
+
+int MeshLod::getLevelCount() const
+{
+    return levels.size() + 1;
+}
+
+Mesh& MeshLod::getLevel(int level)
+{
+    return level == 0 ? *mesh : *levels[level - 1];
+}
+
+double MeshLod::getError(int level) const
+{
+    return errors[level];
+}
+
+Bounds MeshLod::getBounds() const
+{
+    return bounds;
+}
+
+int MeshLod::selectLevel(double pixelsPerUnit, double maxPixels) const
+{
+    int level = 0;
+    while (level + 1 < getLevelCount() && errors[level + 1] * pixelsPerUnit <= maxPixels)
+        level++;
+    return level;
+}
@@ -0,0 +1,42 @@
+#ifndef MESHLOD_HPP
+#define MESHLOD_HPP
+
+#include "Mesh.hpp"
+
+#include <memory>
+#include <vector>
+
+// A mesh with a chain of simplified copies of it, each made by continuing
+// the simplification of the one before (see MeshSimplifier), so the
+// chain's errors only grow. Level 0 is the mesh itself, which the chain
+// doesn't own. Renderer::renderMesh picks a level from how big the
+// simplification error would look on screen
+class MeshLod
+{
+public:
+    MeshLod(Mesh* mesh);
+
+    // Each level keeps about reduction of the triangles of the one before.
+    // Stops at maxLevels levels, including the mesh itself, below
+    // minTriangles, or when the mesh can't be simplified any further
+    void generate(int maxLevels = 6, double reduction = 0.5, int minTriangles = 64);
+
+    int getLevelCount() const;
+    Mesh& getLevel(int level);
+    // The largest distance, in model units, that the level's surface was
+    // moved by simplification
+    double getError(int level) const;
+    // Of the original mesh, which all the levels stay close to
+    Bounds getBounds() const;
+
+    // The coarsest level whose error stays within maxPixels when one model
+    // unit covers pixelsPerUnit pixels
+    int selectLevel(double pixelsPerUnit, double maxPixels) const;
+private:
+    Mesh* mesh;
+    Bounds bounds;
+    std::vector<std::unique_ptr<Mesh>> levels;
+    std::vector<double> errors;
+};
+
+#endif
@@ -0,0 +1,421 @@
+#include "MeshSimplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+
+MeshSimplifier::Quadric::Quadric()
+    : a00{ 0.0 }, a01{ 0.0 }, a02{ 0.0 }, a11{ 0.0 }, a12{ 0.0 }, a22{ 0.0 }, b0{ 0.0 }, b1{ 0.0 }, b2{ 0.0 }, c{ 0.0 }
+{
+}
+
+void MeshSimplifier::Quadric::addPlane(Vector3 normal, double distance, double weight)
+{
+    a00 += weight * normal.x * normal.x;
+    a01 += weight * normal.x * normal.y;
+    a02 += weight * normal.x * normal.z;
+    a11 += weight * normal.y * normal.y;
+    a12 += weight * normal.y * normal.z;
+    a22 += weight * normal.z * normal.z;
+    b0 += weight * normal.x * distance;
+    b1 += weight * normal.y * distance;
+    b2 += weight * normal.z * distance;
+    c += weight * distance * distance;
+}
+
+void MeshSimplifier::Quadric::add(const Quadric& quadric)
+{
+    a00 += quadric.a00;
+    a01 += quadric.a01;
+    a02 += quadric.a02;
+    a11 += quadric.a11;
+    a12 += quadric.a12;
+    a22 += quadric.a22;
+    b0 += quadric.b0;
+    b1 += quadric.b1;
+    b2 += quadric.b2;
+    c += quadric.c;
+}
+
+double MeshSimplifier::Quadric::evaluate(Vector3 p) const
+{
+    double x = a00 * p.x + a01 * p.y + a02 * p.z + b0;
+    double y = a01 * p.x + a11 * p.y + a12 * p.z + b1;
+    double z = a02 * p.x + a12 * p.y + a22 * p.z + b2;
+    return x * p.x + y * p.y + z * p.z + b0 * p.x + b1 * p.y + b2 * p.z + c;
+}
+
+namespace
+{
+    Vector3 difference(Vector3 a, Vector3 b)
+    {
+        a.sub(b);
+        return a;
+    }
+
+    Vector3 triangleNormal(Vector3 p0, Vector3 p1, Vector3 p2)
+    {
+        return difference(p1, p0).cross(difference(p2, p0));
+    }
+
+    uint64_t edgeKey(int a, int b)
+    {
+        if (a > b)
+            std::swap(a, b);
+        return (uint64_t) a << 32 | (uint32_t) b;
+    }
+}
+
+MeshSimplifier::MeshSimplifier(const Mesh& mesh)
+    : vertices{ mesh.getVertices() }, error{ 0.0 }
+{
+    buildPositions();
+
+    // Triangles with two corners in one place have no area and would only
+    // confuse the edge bookkeeping
+    for (const Triangle& triangle : mesh.getTriangles())
+    {
+        int p0 = vertexPositions[triangle.v0];
+        int p1 = vertexPositions[triangle.v1];
+        int p2 = vertexPositions[triangle.v2];
+        if (p0 != p1 && p1 != p2 && p2 != p0)
+            triangles.push_back(triangle);
+    }
+
+    buildQuadrics();
+}
+
+void MeshSimplifier::simplify(int targetTriangles, double maxError)
+{
+    std::vector<std::pair<int, int>> mapping;
+    std::vector<int> remap(vertices.size());
+    std::vector<bool> locked(positions.size());
+    bool errorReached = false;
+
+    // Each pass collapses the cheapest edges whose neighborhoods no earlier
+    // collapse of the same pass has touched. Those still look the way they
+    // did at the start of the pass, so the costs worked out then stay
+    // valid, and the checks can wait until an edge's turn comes
+    while ((int) triangles.size() > targetTriangles && !errorReached)
+    {
+        buildAdjacency();
+
+        std::vector<uint64_t> edges;
+        edges.reserve(triangles.size() * 3);
+        for (const Triangle& triangle : triangles)
+        {
+            int p0 = vertexPositions[triangle.v0];
+            int p1 = vertexPositions[triangle.v1];
+            int p2 = vertexPositions[triangle.v2];
+            edges.push_back(edgeKey(p0, p1));
+            edges.push_back(edgeKey(p1, p2));
+            edges.push_back(edgeKey(p2, p0));
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        // Costs are the weighted mean squared distance to the planes of both
+        // endpoints. Either end can move, so every edge goes in twice
+        std::vector<Collapse> collapses;
+        collapses.reserve(edges.size() * 2);
+        for (uint64_t edge : edges)
+        {
+            int p = (int) (edge >> 32);
+            int q = (int) (edge & 0xFFFFFFFF);
+            Quadric sum = quadrics[p];
+            sum.add(quadrics[q]);
+            double weight = std::max(weights[p] + weights[q], 1e-30);
+            collapses.push_back(Collapse{ std::max(sum.evaluate(positions[q]), 0.0) / weight, p, q });
+            collapses.push_back(Collapse{ std::max(sum.evaluate(positions[p]), 0.0) / weight, q, p });
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+        {
+            return a.cost < b.cost;
+        });
+
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(locked.begin(), locked.end(), false);
+        int triangleCount = triangles.size();
+        int applied = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (triangleCount <= targetTriangles)
+                break;
+            double collapseError = sqrt(collapse.cost);
+            if (collapseError > maxError)
+            {
+                errorReached = true;
+                break;
+            }
+            int from = collapse.from;
+            int to = collapse.to;
+            if (locked[from] || locked[to] || !canCollapse(from, to, mapping))
+                continue;
+
+            for (const std::pair<int, int>& pair : mapping)
+                remap[pair.first] = pair.second;
+            forTriangles(from, [&](int t)
+            {
+                const Triangle& triangle = triangles[t];
+                for (int v : { triangle.v0, triangle.v1, triangle.v2 })
+                {
+                    locked[vertexPositions[v]] = true;
+                    if (vertexPositions[v] == to)
+                        triangleCount--;
+                }
+            });
+            quadrics[to].add(quadrics[from]);
+            weights[to] += weights[from];
+            error = std::max(error, collapseError);
+            applied++;
+        }
+        if (applied == 0)
+            break;
+
+        // Triangles that lost an edge have two corners in one place now
+        int kept = 0;
+        for (Triangle triangle : triangles)
+        {
+            triangle.v0 = remap[triangle.v0];
+            triangle.v1 = remap[triangle.v1];
+            triangle.v2 = remap[triangle.v2];
+            int p0 = vertexPositions[triangle.v0];
+            int p1 = vertexPositions[triangle.v1];
+            int p2 = vertexPositions[triangle.v2];
+            if (p0 != p1 && p1 != p2 && p2 != p0)
+                triangles[kept++] = triangle;
+        }
+        triangles.resize(kept);
+    }
+}
+
+int MeshSimplifier::getTriangleCount() const
+{
+    return triangles.size();
+}
+
+double MeshSimplifier::getError() const
+{
+    return error;
+}
+
+Mesh* MeshSimplifier::createMesh() const
+{
+    std::vector<int> newIndex(vertices.size(), -1);
+    std::vector<Vertex> usedVertices;
+    std::vector<Triangle> usedTriangles;
+    usedTriangles.reserve(triangles.size());
+    auto renumber = [&](int v)
+    {
+        if (newIndex[v] < 0)
+        {
+            newIndex[v] = usedVertices.size();
+            usedVertices.push_back(vertices[v]);
+        }
+        return newIndex[v];
+    };
+    for (const Triangle& triangle : triangles)
+    {
+        int v0 = renumber(triangle.v0);
+        int v1 = renumber(triangle.v1);
+        int v2 = renumber(triangle.v2);
+        usedTriangles.push_back(Triangle{ v0, v1, v2 });
+    }
+
+    Mesh* mesh = new Mesh{ std::move(usedVertices), std::move(usedTriangles), Mesh::Shading::KEEP_NORMALS };
+    mesh->optimizeVertexCache();
+    return mesh;
+}
+
+void MeshSimplifier::buildPositions()
+{
+    int vertexCount = vertices.size();
+    std::vector<int> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [this](int a, int b)
+    {
+        const Vector3& p = vertices[a].xyz;
+        const Vector3& q = vertices[b].xyz;
+        return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    vertexPositions.resize(vertexCount);
+    positions.clear();
+    for (int i = 0; i < vertexCount; i++)
+    {
+        int v = order[i];
+        if (i == 0 || less(order[i - 1], v))
+            positions.push_back(vertices[v].xyz);
+        vertexPositions[v] = positions.size() - 1;
+    }
+
+    int positionCount = positions.size();
+    positionStart.assign(positionCount + 1, 0);
+    for (int v = 0; v < vertexCount; v++)
+        positionStart[vertexPositions[v] + 1]++;
+    for (int p = 0; p < positionCount; p++)
+        positionStart[p + 1] += positionStart[p];
+    positionVertices.resize(vertexCount);
+    std::vector<int> filled(positionStart.begin(), positionStart.end() - 1);
+    for (int v = 0; v < vertexCount; v++)
+        positionVertices[filled[vertexPositions[v]]++] = v;
+}
+
+void MeshSimplifier::buildQuadrics()
+{
+    quadrics.assign(positions.size(), Quadric{});
+    weights.assign(positions.size(), 0.0);
+
+    // An edge between two vertices that only one triangle uses is on an
+    // open border, or on a seam where the triangle across it has different
+    // vertices at the same positions
+    std::unordered_map<uint64_t, int> edgeUses;
+    edgeUses.reserve(triangles.size() * 3);
+    for (const Triangle& triangle : triangles)
+    {
+        edgeUses[edgeKey(triangle.v0, triangle.v1)]++;
+        edgeUses[edgeKey(triangle.v1, triangle.v2)]++;
+        edgeUses[edgeKey(triangle.v2, triangle.v0)]++;
+    }
+
+    for (const Triangle& triangle : triangles)
+    {
+        int corners[3] = { triangle.v0, triangle.v1, triangle.v2 };
+        int cornerPositions[3] = { vertexPositions[corners[0]], vertexPositions[corners[1]], vertexPositions[corners[2]] };
+        Vector3 p[3] = { positions[cornerPositions[0]], positions[cornerPositions[1]], positions[cornerPositions[2]] };
+        Vector3 normal = triangleNormal(p[0], p[1], p[2]);
+        double doubleArea = normal.len();
+        if (doubleArea == 0.0)
+            continue;
+        normal.scl(1.0 / doubleArea);
+        double distance = -normal.dot(p[0]);
+        for (int k = 0; k < 3; k++)
+        {
+            quadrics[cornerPositions[k]].addPlane(normal, distance, doubleArea * 0.5);
+            weights[cornerPositions[k]] += doubleArea * 0.5;
+        }
+
+        // Planes through border and seam edges, square to the triangle, so
+        // their endpoints can slide along them but not away
+        for (int k = 0; k < 3; k++)
+        {
+            int next = (k + 1) % 3;
+            if (edgeUses[edgeKey(corners[k], corners[next])] != 1)
+                continue;
+            Vector3 edge = difference(p[next], p[k]);
+            Vector3 side = edge.cross(normal);
+            double sideLength = side.len();
+            if (sideLength == 0.0)
+                continue;
+            side.scl(1.0 / sideLength);
+            double sideDistance = -side.dot(p[k]);
+            double weight = borderWeight * edge.len2();
+            quadrics[cornerPositions[k]].addPlane(side, sideDistance, weight);
+            quadrics[cornerPositions[next]].addPlane(side, sideDistance, weight);
+            weights[cornerPositions[k]] += weight;
+            weights[cornerPositions[next]] += weight;
+        }
+    }
+}
+
+void MeshSimplifier::buildAdjacency()
+{
+    int vertexCount = vertices.size();
+    adjacencyStart.assign(vertexCount + 1, 0);
+    for (const Triangle& triangle : triangles)
+        for (int v : { triangle.v0, triangle.v1, triangle.v2 })
+            adjacencyStart[v + 1]++;
+    for (int v = 0; v < vertexCount; v++)
+        adjacencyStart[v + 1] += adjacencyStart[v];
+    adjacency.resize(triangles.size() * 3);
+    std::vector<int> filled(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (int i = 0; i < triangles.size(); i++)
+        for (int v : { triangles[i].v0, triangles[i].v1, triangles[i].v2 })
+            adjacency[filled[v]++] = i;
+}
+
+bool MeshSimplifier::mapVertices(int from, int to, std::vector<std::pair<int, int>>& mapping) const
+{
+    mapping.clear();
+    for (int i = positionStart[from]; i < positionStart[from + 1]; i++)
+    {
+        int vertex = positionVertices[i];
+        int match = -1;
+        for (int j = adjacencyStart[vertex]; j < adjacencyStart[vertex + 1]; j++)
+        {
+            const Triangle& triangle = triangles[adjacency[j]];
+            for (int v : { triangle.v0, triangle.v1, triangle.v2 })
+            {
+                if (vertexPositions[v] != to)
+                    continue;
+                if (match >= 0 && match != v)
+                    return false;
+                match = v;
+            }
+        }
+        // Vertices that were collapsed away earlier have no triangles left
+        if (adjacencyStart[vertex] == adjacencyStart[vertex + 1])
+            continue;
+        if (match < 0)
+            return false;
+        mapping.push_back({ vertex, match });
+    }
+    return !mapping.empty();
+}
+
+bool MeshSimplifier::canCollapse(int from, int to, std::vector<std::pair<int, int>>& mapping) const
+{
+    if (!mapVertices(from, to, mapping))
+        return false;
+
+    // Positions next to both ends must be the tips of the triangles on the
+    // edge, or the collapse would fold two sheets of surface together
+    toNeighbors.clear();
+    forTriangles(to, [&](int t)
+    {
+        const Triangle& triangle = triangles[t];
+        for (int v : { triangle.v0, triangle.v1, triangle.v2 })
+            toNeighbors.push_back(vertexPositions[v]);
+    });
+    std::sort(toNeighbors.begin(), toNeighbors.end());
+    edgeTips.clear();
+    forTriangles(from, [&](int t)
+    {
+        const Triangle& triangle = triangles[t];
+        int p[3] = { vertexPositions[triangle.v0], vertexPositions[triangle.v1], vertexPositions[triangle.v2] };
+        if (p[0] == to || p[1] == to || p[2] == to)
+            for (int k = 0; k < 3; k++)
+                if (p[k] != from && p[k] != to)
+                    edgeTips.push_back(p[k]);
+    });
+
+    bool valid = true;
+    Vector3 target = positions[to];
+    forTriangles(from, [&](int t)
+    {
+        const Triangle& triangle = triangles[t];
+        int p[3] = { vertexPositions[triangle.v0], vertexPositions[triangle.v1], vertexPositions[triangle.v2] };
+        if (!valid || p[0] == to || p[1] == to || p[2] == to)
+            return;
+
+        for (int k = 0; k < 3; k++)
+            if (p[k] != from && std::binary_search(toNeighbors.begin(), toNeighbors.end(), p[k]) &&
+                std::find(edgeTips.begin(), edgeTips.end(), p[k]) == edgeTips.end())
+                valid = false;
+
+        // The remaining triangles must keep facing about the same way
+        Vector3 before[3] = { positions[p[0]], positions[p[1]], positions[p[2]] };
+        Vector3 after[3] = { before[0], before[1], before[2] };
+        for (int k = 0; k < 3; k++)
+            if (p[k] == from)
+                after[k] = target;
+        Vector3 normalBefore = triangleNormal(before[0], before[1], before[2]);
+        Vector3 normalAfter = triangleNormal(after[0], after[1], after[2]);
+        if (normalAfter.dot(normalBefore) <= 0.25 * sqrt(normalAfter.len2() * normalBefore.len2()))
+            valid = false;
+    });
+    return valid;
+}
@@ -0,0 +1,103 @@
+#ifndef MESHSIMPLIFIER_HPP
+#define MESHSIMPLIFIER_HPP
+
+#include "Mesh.hpp"
+
+#include <limits>
+#include <vector>
+
+// Quadric error edge collapse (Garland and Heckbert). Every position keeps
+// the area-weighted sum of the planes of the triangles around it, and the
+// cheapest edges are collapsed first, one endpoint moving onto the other,
+// so vertex attributes are never interpolated. Vertices that share a
+// position but not their attributes, along UV seams and hard normal
+// edges, only move together along the seam, and extra planes across seams
+// and open borders keep them from drifting off. Collapses that would flip
+// a triangle or fold the surface onto itself are skipped
+class MeshSimplifier
+{
+public:
+    MeshSimplifier(const Mesh& mesh);
+
+    // Collapses edges until at most targetTriangles are left, no edge can
+    // collapse, or the next collapse would cost more than maxError. Can be
+    // called again with a lower target to continue from where it stopped
+    void simplify(int targetTriangles, double maxError = std::numeric_limits<double>::max());
+
+    int getTriangleCount() const;
+    // The largest collapse error so far, as a distance in model units
+    double getError() const;
+
+    // The simplified mesh with only the vertices still in use, ordered for
+    // the vertex cache
+    Mesh* createMesh() const;
+private:
+    // Symmetric 4x4 matrix, stored as the 3x3 block, the column next to it
+    // and the corner
+    struct Quadric
+    {
+        Quadric();
+
+        void addPlane(Vector3 normal, double distance, double weight);
+        void add(const Quadric& quadric);
+        double evaluate(Vector3 point) const;
+
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+    };
+
+    // from moves onto to
+    struct Collapse
+    {
+        double cost;
+        int from;
+        int to;
+    };
+
+    // Extra weight of the planes along borders and seams
+    static constexpr double borderWeight = 10.0;
+
+    std::vector<Vertex> vertices;
+    std::vector<Triangle> triangles;
+    double error;
+
+    // Vertices with exactly the same xyz share a position, which is what
+    // collapses move
+    std::vector<Vector3> positions;
+    std::vector<int> vertexPositions;
+    std::vector<int> positionStart;
+    std::vector<int> positionVertices;
+    std::vector<Quadric> quadrics;
+    std::vector<double> weights;
+
+    // Triangles around every vertex, rebuilt on each pass
+    std::vector<int> adjacencyStart;
+    std::vector<int> adjacency;
+
+    // Scratch space for canCollapse
+    mutable std::vector<int> toNeighbors;
+    mutable std::vector<int> edgeTips;
+
+    void buildPositions();
+    void buildQuadrics();
+    void buildAdjacency();
+
+    // Pairs every vertex at from with the one at to it shares an edge with.
+    // False if one of them has none or several
+    bool mapVertices(int from, int to, std::vector<std::pair<int, int>>& mapping) const;
+    bool canCollapse(int from, int to, std::vector<std::pair<int, int>>& mapping) const;
+    // Calls visit(triangle) for every triangle around position
+    template<typename Visit>
+    void forTriangles(int position, Visit visit) const
+    {
+        for (int i = positionStart[position]; i < positionStart[position + 1]; i++)
+        {
+            int vertex = positionVertices[i];
+            for (int j = adjacencyStart[vertex]; j < adjacencyStart[vertex + 1]; j++)
+                visit(adjacency[j]);
+        }
+    }
+};
+
+#endif
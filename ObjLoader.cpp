@@ -0,0 +1,456 @@
+#include "ObjLoader.hpp"
+#include "MappedFile.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+Mesh* ObjLoader::load(std::string objFile, Mesh::Shading shading)
+{
+    MappedFile file{ objFile };
+    ThreadPool threadPool;
+    if (!file.isOpen())
+        return build(ObjData{}, shading, threadPool);
+
+    // Chunks start at line boundaries. There are a few per thread so that
+    // ones heavy on faces don't hold the rest up, but small files stay in
+    // one piece
+    const char* begin = file.getData();
+    const char* end = begin + file.getSize();
+    const size_t minChunkSize = 1 << 20;
+    int threadCount = threadPool.getThreadCount();
+    int chunkCount = std::max(1, (int) std::min<size_t>(threadCount > 1 ? threadCount * 4 : 1, file.getSize() / minChunkSize));
+    std::vector<const char*> bounds(chunkCount + 1, end);
+    bounds[0] = begin;
+    for (int i = 1; i < chunkCount; i++)
+    {
+        const char* p = std::max(begin + file.getSize() * i / chunkCount, bounds[i - 1]);
+        while (p < end && p[-1] != '\n')
+            p++;
+        bounds[i] = p;
+    }
+
+    std::vector<ObjData> chunks(chunkCount);
+    threadPool.run(chunkCount, [&](int chunk)
+    {
+        parse(bounds[chunk], bounds[chunk + 1], chunk == 0, chunks[chunk]);
+    });
+    if (chunkCount == 1)
+        return build(chunks[0], shading, threadPool);
+    return build(merge(chunks, threadPool), shading, threadPool);
+}
+
+void ObjLoader::parse(const char* begin, const char* end, bool fileStart, ObjData& data)
+{
+    auto isBlank = [](char c) { return c == ' ' || c == '\t'; };
+    // Reused for every face, so polygons don't allocate once it has grown
+    struct PolygonCorner
+    {
+        WavefrontIndices indices;
+        // Bit n is set if component n is relative to the chunk
+        int relative;
+    };
+    std::vector<PolygonCorner> polygon;
+    // Relative indices are final in the chunk that starts the file, so
+    // ones landing before it are invalid right away, as shift does for
+    // the other chunks when they are merged
+    auto resolve = [fileStart](int index, int count, int component, int& relative)
+    {
+        if (index > 0)
+            return index - 1;
+        if (index == 0)
+            return invalidIndex;
+        if (fileStart)
+            return count + index >= 0 ? count + index : invalidIndex;
+        relative |= 1 << component;
+        return count + index;
+    };
+
+    const char* p = begin;
+    while (p < end)
+    {
+        while (p < end && isBlank(*p))
+            p++;
+        const char* tag = p;
+        while (p < end && !isBlank(*p) && *p != '\n' && *p != '\r')
+            p++;
+        int tagLength = p - tag;
+
+        if (tagLength == 1 && tag[0] == 'v')
+        {
+            Vector3 position;
+            parseDouble(p, end, position.x);
+            parseDouble(p, end, position.y);
+            parseDouble(p, end, position.z);
+            data.positions.push_back(position);
+        }
+        else if (tagLength == 2 && tag[0] == 'v' && tag[1] == 't')
+        {
+            Vector2 texCoord;
+            parseDouble(p, end, texCoord.x);
+            parseDouble(p, end, texCoord.y);
+            data.texCoords.push_back(texCoord);
+        }
+        else if (tagLength == 2 && tag[0] == 'v' && tag[1] == 'n')
+        {
+            Vector3 normal;
+            parseDouble(p, end, normal.x);
+            parseDouble(p, end, normal.y);
+            parseDouble(p, end, normal.z);
+            data.normals.push_back(normal);
+        }
+        else if (tagLength == 1 && tag[0] == 'f')
+        {
+            polygon.clear();
+            int index;
+            while (parseInt(p, end, index))
+            {
+                PolygonCorner corner{ WavefrontIndices{ 0, -1, -1 }, 0 };
+                corner.indices.v = resolve(index, data.positions.size(), 0, corner.relative);
+                if (p < end && *p == '/')
+                {
+                    p++;
+                    if (p < end && *p != '/' && parseInt(p, end, index))
+                        corner.indices.vt = resolve(index, data.texCoords.size(), 1, corner.relative);
+                    if (p < end && *p == '/')
+                    {
+                        p++;
+                        if (parseInt(p, end, index))
+                            corner.indices.vn = resolve(index, data.normals.size(), 2, corner.relative);
+                    }
+                }
+                polygon.push_back(corner);
+            }
+            for (int i = 2; i < polygon.size(); i++)
+                for (const PolygonCorner* corner : { &polygon[0], &polygon[i - 1], &polygon[i] })
+                {
+                    if (corner->relative)
+                        data.relativeCorners.push_back(std::make_pair((int) data.corners.size(), corner->relative));
+                    data.corners.push_back(corner->indices);
+                }
+        }
+
+        // Whatever is left of the line, including comments and tags this
+        // loader has no use for
+        while (p < end && *p != '\n')
+            p++;
+        p++;
+    }
+}
+
+ObjLoader::ObjData ObjLoader::merge(std::vector<ObjData>& chunks, ThreadPool& threadPool)
+{
+    struct Offsets
+    {
+        int positions, texCoords, normals, corners;
+    };
+    std::vector<Offsets> offsets(chunks.size() + 1, Offsets{ 0, 0, 0, 0 });
+    for (int i = 0; i < chunks.size(); i++)
+        offsets[i + 1] = Offsets
+        {
+            offsets[i].positions + (int) chunks[i].positions.size(),
+            offsets[i].texCoords + (int) chunks[i].texCoords.size(),
+            offsets[i].normals + (int) chunks[i].normals.size(),
+            offsets[i].corners + (int) chunks[i].corners.size()
+        };
+
+    ObjData data;
+    data.positions.resize(offsets.back().positions);
+    data.texCoords.resize(offsets.back().texCoords);
+    data.normals.resize(offsets.back().normals);
+    data.corners.resize(offsets.back().corners);
+    threadPool.run(chunks.size(), [&](int chunk)
+    {
+        ObjData& source = chunks[chunk];
+        const Offsets& offset = offsets[chunk];
+        std::copy(source.positions.begin(), source.positions.end(), data.positions.begin() + offset.positions);
+        std::copy(source.texCoords.begin(), source.texCoords.end(), data.texCoords.begin() + offset.texCoords);
+        std::copy(source.normals.begin(), source.normals.end(), data.normals.begin() + offset.normals);
+        std::copy(source.corners.begin(), source.corners.end(), data.corners.begin() + offset.corners);
+        // Relative indices were resolved against the chunk's own counts,
+        // so they move with the chunk. Ones that still land before the
+        // start of the file are invalid
+        auto shift = [](int& index, int by)
+        {
+            index += by;
+            if (index < 0)
+                index = invalidIndex;
+        };
+        for (const std::pair<int, int>& relative : source.relativeCorners)
+        {
+            WavefrontIndices& corner = data.corners[offset.corners + relative.first];
+            if (relative.second & 1)
+                shift(corner.v, offset.positions);
+            if (relative.second & 2)
+                shift(corner.vt, offset.texCoords);
+            if (relative.second & 4)
+                shift(corner.vn, offset.normals);
+        }
+        source = ObjData{};
+    });
+    return data;
+}
+
+Mesh* ObjLoader::build(const ObjData& data, Mesh::Shading shading, ThreadPool& threadPool)
+{
+    int positionCount = data.positions.size();
+    int texCoordCount = data.texCoords.size();
+    int normalCount = data.normals.size();
+    auto isValid = [=](const WavefrontIndices& corner)
+    {
+        return corner.v >= 0 && corner.v < positionCount
+            && corner.vt >= -1 && corner.vt < texCoordCount
+            && corner.vn >= -1 && corner.vn < normalCount;
+    };
+
+    // Corners are deduplicated in an open-addressing table of corner
+    // numbers, filled by every thread at once with compare-and-swap. A
+    // slot ends up holding the first corner with its indices, so vertices
+    // can be numbered in order of first use exactly as a serial pass would
+    int cornerCount = data.corners.size();
+    int triangleCount = cornerCount / 3;
+    int tableSize = 1;
+    while (tableSize < cornerCount * 2)
+        tableSize *= 2;
+    int mask = tableSize - 1;
+    std::unique_ptr<std::atomic<int>[]> table{ new std::atomic<int>[tableSize] };
+    // The slot of each inserted corner, -1 for corners of dropped
+    // triangles. Once the table is complete it is replaced by the first
+    // corner with the same indices, which is nearby in the file more often
+    // than not, so later passes stay out of the table
+    std::vector<int> firstOf(cornerCount, -1);
+
+    // Jobs cover whole triangles, and a triangle is dropped if any of its
+    // corners is out of range
+    const int trianglesPerJob = 16384;
+    int jobCount = (triangleCount + trianglesPerJob - 1) / trianglesPerJob;
+    auto jobTriangles = [=](int job)
+    {
+        return std::make_pair(job * trianglesPerJob, std::min((job + 1) * trianglesPerJob, triangleCount));
+    };
+    auto isValidTriangle = [&](int triangle)
+    {
+        return isValid(data.corners[triangle * 3]) && isValid(data.corners[triangle * 3 + 1]) && isValid(data.corners[triangle * 3 + 2]);
+    };
+
+    threadPool.run((tableSize + 65535) / 65536, [&](int job)
+    {
+        for (int i = job * 65536; i < std::min((job + 1) * 65536, tableSize); i++)
+            table[i].store(-1, std::memory_order_relaxed);
+    });
+
+    // Probes land all over the table, so the slot of a corner a little
+    // further on is fetched ahead while this one is inserted
+    const int prefetchDistance = 16;
+    WavefrontIndices::Hash hash;
+    threadPool.run(jobCount, [&](int job)
+    {
+        std::pair<int, int> range = jobTriangles(job);
+        for (int triangle = range.first; triangle < range.second; triangle++)
+        {
+            if (triangle * 3 + prefetchDistance < cornerCount)
+                for (int ahead = triangle * 3 + prefetchDistance; ahead < triangle * 3 + prefetchDistance + 3; ahead++)
+                    prefetch(&table[hash(data.corners[ahead]) & mask]);
+            if (!isValidTriangle(triangle))
+                continue;
+            for (int corner = triangle * 3; corner < triangle * 3 + 3; corner++)
+            {
+                const WavefrontIndices& indices = data.corners[corner];
+                int slot = hash(indices) & mask;
+                while (true)
+                {
+                    int current = table[slot].load(std::memory_order_relaxed);
+                    if (current < 0 && table[slot].compare_exchange_strong(current, corner, std::memory_order_relaxed))
+                        break;
+                    // Everything ever stored in a slot has the same indices,
+                    // so lowering it to this corner is safe
+                    if (data.corners[current] == indices)
+                    {
+                        while (corner < current && !table[slot].compare_exchange_weak(current, corner, std::memory_order_relaxed))
+                            ;
+                        break;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+                firstOf[corner] = slot;
+            }
+        }
+    });
+
+    // Vertex and triangle numbers come from per-job counts and a prefix sum
+    struct JobCounts
+    {
+        int vertices, triangles;
+    };
+    std::vector<JobCounts> counts(jobCount + 1, JobCounts{ 0, 0 });
+    threadPool.run(jobCount, [&](int job)
+    {
+        std::pair<int, int> range = jobTriangles(job);
+        JobCounts& count = counts[job + 1];
+        for (int corner = range.first * 3; corner < range.second * 3; corner++)
+        {
+            if (corner + prefetchDistance < cornerCount && firstOf[corner + prefetchDistance] >= 0)
+                prefetch(&table[firstOf[corner + prefetchDistance]]);
+            if (firstOf[corner] >= 0)
+            {
+                firstOf[corner] = table[firstOf[corner]].load(std::memory_order_relaxed);
+                count.vertices += firstOf[corner] == corner;
+                count.triangles += corner % 3 == 0;
+            }
+        }
+    });
+    for (int job = 0; job < jobCount; job++)
+    {
+        counts[job + 1].vertices += counts[job].vertices;
+        counts[job + 1].triangles += counts[job].triangles;
+    }
+
+    std::vector<Vertex> vertices(counts.back().vertices);
+    std::vector<Triangle> triangles(counts.back().triangles);
+    std::vector<uint8_t> missingNormals(vertices.size());
+    std::vector<int> vertexOf(cornerCount);
+    threadPool.run(jobCount, [&](int job)
+    {
+        std::pair<int, int> range = jobTriangles(job);
+        int vertex = counts[job].vertices;
+        for (int corner = range.first * 3; corner < range.second * 3; corner++)
+        {
+            if (firstOf[corner] != corner)
+                continue;
+            const WavefrontIndices& indices = data.corners[corner];
+            Vector2 uv = indices.vt >= 0 ? data.texCoords[indices.vt] : Vector2{ 0.0, 0.0 };
+            Vector3 normal = indices.vn >= 0 ? data.normals[indices.vn] : Vector3{ 0.0, 0.0, 0.0 };
+            missingNormals[vertex] = indices.vn < 0;
+            vertices[vertex] = Vertex{ data.positions[indices.v], Vector3{ 1.0, 1.0, 1.0 }, uv, normal };
+            vertexOf[corner] = vertex++;
+        }
+    });
+    threadPool.run(jobCount, [&](int job)
+    {
+        std::pair<int, int> range = jobTriangles(job);
+        int triangle = counts[job].triangles;
+        for (int corner = range.first * 3; corner < range.second * 3; corner += 3)
+            if (firstOf[corner] >= 0)
+                triangles[triangle++] = Triangle
+                {
+                    vertexOf[firstOf[corner]], vertexOf[firstOf[corner + 1]], vertexOf[firstOf[corner + 2]]
+                };
+    });
+
+    if (std::find(missingNormals.begin(), missingNormals.end(), 1) != missingNormals.end())
+    {
+        // The unnormalized cross product weights each face by its area
+        for (const Triangle& triangle : triangles)
+        {
+            Vector3 edge1 = vertices[triangle.v1].xyz;
+            Vector3 edge2 = vertices[triangle.v2].xyz;
+            edge1.sub(vertices[triangle.v0].xyz);
+            edge2.sub(vertices[triangle.v0].xyz);
+            Vector3 normal = edge1.cross(edge2);
+            for (int v : { triangle.v0, triangle.v1, triangle.v2 })
+                if (missingNormals[v])
+                    vertices[v].normal.add(normal);
+        }
+    }
+
+    return new Mesh{ std::move(vertices), std::move(triangles), shading };
+}
+
+bool ObjLoader::parseDouble(const char*& p, const char* end, double& value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    // Up to 19 significant digits fit in the mantissa; any more only move
+    // the decimal point
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    bool anyDigits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        anyDigits = true;
+        if (significantDigits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            significantDigits += mantissa > 0;
+        }
+        else
+            exponent++;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            anyDigits = true;
+            if (significantDigits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                significantDigits += mantissa > 0;
+                exponent--;
+            }
+        }
+    }
+    if (!anyDigits)
+    {
+        p = start;
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* exponentStart = p;
+        p++;
+        int exponentValue;
+        if (p < end && *p != ' ' && *p != '\t' && parseInt(p, end, exponentValue))
+            exponent += exponentValue;
+        else
+            p = exponentStart;
+    }
+
+    // Powers of ten up to 22 are exact in a double, so within that range
+    // one multiply or divide of an exact mantissa rounds correctly
+    static const double powers[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    double result = (double) mantissa;
+    if (exponent >= 0 && exponent <= 22)
+        result *= powers[exponent];
+    else if (exponent < 0 && exponent >= -22)
+        result /= powers[-exponent];
+    else
+        result *= pow(10.0, exponent);
+    value = negative ? -result : result;
+    return true;
+}
+
+bool ObjLoader::parseInt(const char*& p, const char* end, int& value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p == end || *p < '0' || *p > '9')
+    {
+        p = start;
+        return false;
+    }
+    int64_t result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        if (result < INT32_MAX)
+            result = result * 10 + (*p - '0');
+    if (result > INT32_MAX)
+        result = INT32_MAX;
+    value = (int) (negative ? -result : result);
+    return true;
+}
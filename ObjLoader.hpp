@@ -0,0 +1,52 @@
+#ifndef OBJLOADER_HPP
+#define OBJLOADER_HPP
+
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Wavefront OBJ loading. The file is memory-mapped and parsed in place
+// with hand-written number parsing, so nothing is allocated per line.
+// Faces may use v, v/vt, v//vn or v/vt/vn corners with positive or
+// negative (relative) indices, and polygons are split into triangle fans.
+// Corners without a normal get the area-weighted average of the faces
+// around them, and triangles that refer outside the data are skipped.
+// Large files are split at line boundaries and parsed on every thread, and
+// vertices are deduplicated in parallel
+class ObjLoader
+{
+public:
+    // Never null: a missing or unreadable file gives an empty mesh
+    static Mesh* load(std::string objFile, Mesh::Shading shading);
+private:
+    // Zero-based indices, -1 where a corner has no texture coordinate or
+    // normal. Three corners per triangle
+    struct ObjData
+    {
+        std::vector<Vector3> positions;
+        std::vector<Vector2> texCoords;
+        std::vector<Vector3> normals;
+        std::vector<WavefrontIndices> corners;
+        // Corners with negative OBJ indices, which are resolved against the
+        // chunk being parsed: the corner and a bit per relative component.
+        // Empty for the chunk that starts the file
+        std::vector<std::pair<int, int>> relativeCorners;
+    };
+    // Stands in for an index of 0, or a relative one before the file start
+    static const int invalidIndex = INT32_MAX;
+
+    static void parse(const char* begin, const char* end, bool fileStart, ObjData& data);
+    // Joins chunks parsed on their own, emptying them
+    static ObjData merge(std::vector<ObjData>& chunks, ThreadPool& threadPool);
+    static Mesh* build(const ObjData& data, Mesh::Shading shading, ThreadPool& threadPool);
+
+    // Each parser skips leading blanks, advances p past what it read and
+    // returns false, leaving p after the blanks, if there was no number
+    static bool parseDouble(const char*& p, const char* end, double& value);
+    static bool parseInt(const char*& p, const char* end, int& value);
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "OfflineRenderer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+OfflineRenderer::OfflineRenderer(int width, int height)
+    : width{ width }, height{ height }, mesh{ nullptr }, texture{ nullptr }, lighting{ Renderer::Lighting::NONE }, fov{ 1.57 }, outputFormat{ OutputFormat::NONE }, frameThreads{ 1 }, sink{ nullptr }
+{
+}
+
+void OfflineRenderer::setScene(Mesh* mesh, const Raster* texture, const std::vector<LightSource>& lights, Renderer::Lighting lighting)
+{
+    this->mesh = mesh;
+    this->texture = texture;
+    this->lights = lights;
+    this->lighting = lighting;
+}
+
+void OfflineRenderer::setCameraPath(const std::vector<CameraKey>& path)
+{
+    this->path = path;
+}
+
+void OfflineRenderer::setFov(double fov)
+{
+    this->fov = fov;
+}
+
+void OfflineRenderer::setPostProcess(const PostProcess& postProcess)
+{
+    this->postProcess = postProcess;
+}
+
+void OfflineRenderer::setRendererSetup(const std::function<void(Renderer&)>& setup)
+{
+    this->setup = setup;
+}
+
+void OfflineRenderer::setOutput(std::string prefix, OutputFormat format)
+{
+    outputPrefix = prefix;
+    outputFormat = format;
+}
+
+void OfflineRenderer::setSink(FrameSink* sink)
+{
+    this->sink = sink;
+}
+
+void OfflineRenderer::setFrameThreads(int frameThreads)
+{
+    this->frameThreads = frameThreads;
+}
+
+int OfflineRenderer::render(int frameCount)
+{
+    if (mesh == nullptr || texture == nullptr || path.empty())
+        return frameCount;
+
+    // The mesh builds its streams on first use, which must not happen on
+    // several threads at once
+    mesh->getStreams();
+    if (sink != nullptr)
+        return renderToSink(frameCount);
+
+    ThreadPool framePool{ frameThreads };
+    int workerCount = framePool.getThreadCount();
+    std::atomic<int> nextFrame{ 0 };
+    std::atomic<int> failures{ 0 };
+    framePool.run(workerCount, [&](int)
+    {
+        // With several frames in flight each renderer stays on its own
+        // thread rather than starting a pool of its own
+        Raster image{ width, height };
+        Renderer renderer{ &image, workerCount > 1 ? 1 : 0 };
+        if (setup)
+            setup(renderer);
+
+        Combined transform;
+        for (int frame = nextFrame++; frame < frameCount; frame = nextFrame++)
+        {
+            renderer.clearColorDepth(Color{ 0, 0, 0, 255 });
+            renderer.renderMesh(*mesh, *texture, transform, getCamera(frame, frameCount), lights, lighting);
+            renderer.postProcess(postProcess);
+            renderer.resolveClears();
+            if (!writeFrame(image, frame))
+                failures++;
+        }
+    });
+    return failures;
+}
+
+int OfflineRenderer::renderToSink(int frameCount)
+{
+    // Frames the sink drops are still drawn, into this raster, so that
+    // time moves on at the rate frames render and DROP skips frames rather
+    // than racing through the rest of them
+    Raster placeholder{ width, height };
+    Renderer renderer{ &placeholder };
+    if (setup)
+        setup(renderer);
+
+    Combined transform;
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        Raster* target = sink->acquireFrame();
+        if (target == nullptr && !sink->isOpen())
+            return frameCount - frame;
+        bool dropped = target == nullptr;
+        if (dropped)
+            target = &placeholder;
+        renderer.setImage(target);
+        renderer.clearColorDepth(Color{ 0, 0, 0, 255 });
+        renderer.renderMesh(*mesh, *texture, transform, getCamera(frame, frameCount), lights, lighting);
+        renderer.postProcess(postProcess);
+        renderer.resolveClears();
+        if (!dropped && !sink->submitFrame(target))
+            return frameCount - frame;
+    }
+    return 0;
+}
+
+Camera OfflineRenderer::getCamera(int frame, int frameCount) const
+{
+    double t = frameCount > 1 ? frame * (path.size() - 1) / (double) (frameCount - 1) : 0.0;
+    int key = std::min((int) t, (int) path.size() - 1);
+    const CameraKey& a = path[key];
+    const CameraKey& b = path[std::min(key + 1, (int) path.size() - 1)];
+    double s = t - key;
+    Vector3 position
+    {
+        a.position.x + (b.position.x - a.position.x) * s,
+        a.position.y + (b.position.y - a.position.y) * s,
+        a.position.z + (b.position.z - a.position.z) * s
+    };
+    return Camera{ false, fov, width / (double) height, 0.1, position, a.yaw + (b.yaw - a.yaw) * s, a.pitch + (b.pitch - a.pitch) * s };
+}
+
+bool OfflineRenderer::writeFrame(const Raster& frame, int index) const
+{
+    if (outputFormat == OutputFormat::NONE)
+        return true;
+
+    char number[16];
+    std::snprintf(number, sizeof(number), "%05d", index);
+    std::string file = outputPrefix + number;
+    if (outputFormat == OutputFormat::PPM)
+        return frame.savePpm(file + ".ppm");
+    return frame.saveRaw(file + ".rgba");
+}
@@ -0,0 +1,88 @@
+#ifndef OFFLINERENDERER_HPP
+#define OFFLINERENDERER_HPP
+
+#include "Renderer.hpp"
+#include "Raster.hpp"
+#include "Mesh.hpp"
+#include "Camera.hpp"
+#include "LightSource.hpp"
+#include "PostProcess.hpp"
+#include "FrameSink.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Renders a scene along a camera path into Rasters with no window, for
+// batch jobs, throughput tests and thumbnails on machines without a
+// display. Frames can be split across threads two ways: one frame at a
+// time with every thread working on it, or several frames at once with a
+// single-threaded renderer each, which scales better on small images
+class OfflineRenderer
+{
+public:
+    enum class OutputFormat
+    {
+        NONE, PPM, RAW
+    };
+
+    // A point on the camera path. Keys are spread evenly over the frames
+    // and the camera moves linearly between them
+    struct CameraKey
+    {
+        Vector3 position;
+        double yaw;
+        double pitch;
+    };
+
+    OfflineRenderer(int width, int height);
+
+    void setScene(Mesh* mesh, const Raster* texture, const std::vector<LightSource>& lights, Renderer::Lighting lighting);
+    void setCameraPath(const std::vector<CameraKey>& path);
+    void setFov(double fov);
+    void setPostProcess(const PostProcess& postProcess);
+
+    // Called on every renderer before the first frame, to choose the
+    // rasterizer, mipmapping, sampler and so on
+    void setRendererSetup(const std::function<void(Renderer&)>& setup);
+
+    // Frame i goes to prefix + i, zero-padded to five digits, + ".ppm" or
+    // ".rgba". NONE renders without writing, for throughput tests
+    void setOutput(std::string prefix, OutputFormat format);
+
+    // Streams frames to a sink instead, drawing each one straight into the
+    // sink's raster. Frames reach it in order, so they are rendered one at
+    // a time whatever setFrameThreads says. Frames a DROP sink skips are
+    // rendered all the same and thrown away. nullptr goes back to files
+    void setSink(FrameSink* sink);
+
+    // Frames rendered at the same time. 1 renders one frame at a time with
+    // every thread; 0 uses one frame per hardware core
+    void setFrameThreads(int frameThreads);
+
+    // Returns the number of frames that failed to be written
+    int render(int frameCount);
+private:
+    int width;
+    int height;
+
+    Mesh* mesh;
+    const Raster* texture;
+    std::vector<LightSource> lights;
+    Renderer::Lighting lighting;
+    std::vector<CameraKey> path;
+    double fov;
+    PostProcess postProcess;
+    std::function<void(Renderer&)> setup;
+
+    std::string outputPrefix;
+    OutputFormat outputFormat;
+    int frameThreads;
+    FrameSink* sink;
+
+    int renderToSink(int frameCount);
+    Camera getCamera(int frame, int frameCount) const;
+    bool writeFrame(const Raster& frame, int index) const;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "PipeSink.hpp"
+
+#include <cerrno>
+#include <csignal>
+
+#include <poll.h>
+#include <unistd.h>
+
+PipeSink::PipeSink(int width, int height, Backpressure backpressure, int fd)
+    : fd{ fd }, backpressure{ backpressure }, droppedFrames{ 0 }, open{ true }, frame{ width, height }
+{
+    signal(SIGPIPE, SIG_IGN);
+}
+
+Raster* PipeSink::acquireFrame()
+{
+    if (!open)
+        return nullptr;
+    if (backpressure == Backpressure::DROP)
+    {
+        pollfd writable{ fd, POLLOUT, 0 };
+        if (poll(&writable, 1, 0) == 0)
+        {
+            droppedFrames++;
+            return nullptr;
+        }
+    }
+    return &frame;
+}
+
+bool PipeSink::submitFrame(Raster* frame)
+{
+    if (!open)
+        return false;
+    const uint8_t* data = frame->getData();
+    size_t remaining = (size_t) frame->getWidth() * frame->getHeight() * 4;
+    while (remaining > 0)
+    {
+        ssize_t written = write(fd, data, remaining);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            open = false;
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+    return true;
+}
+
+bool PipeSink::isOpen() const
+{
+    return open;
+}
+
+int PipeSink::getDroppedFrames() const
+{
+    return droppedFrames;
+}
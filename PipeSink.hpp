@@ -0,0 +1,32 @@
+#ifndef PIPESINK_HPP
+#define PIPESINK_HPP
+
+#include "FrameSink.hpp"
+
+// A FrameSink that writes each frame as raw row-major RGBA bytes to a file
+// descriptor, standard output by default, for piping into an encoder. The
+// pipe itself applies back-pressure: BLOCK lets writes wait for the reader,
+// DROP skips a frame when the pipe is still full from the last one. Once a
+// frame is started it is always written whole, so the stream stays aligned
+// to frames. SIGPIPE is ignored, so a reader going away closes the sink
+// instead of ending the process
+class PipeSink : public FrameSink
+{
+public:
+    PipeSink(int width, int height, Backpressure backpressure, int fd = 1);
+
+    Raster* acquireFrame() override;
+    bool submitFrame(Raster* frame) override;
+
+    bool isOpen() const override;
+    int getDroppedFrames() const override;
+private:
+    int fd;
+    Backpressure backpressure;
+    int droppedFrames;
+    bool open;
+    // Frames are written straight from this raster
+    Raster frame;
+};
+
+#endif
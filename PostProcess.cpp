@@ -0,0 +1,274 @@
+#include "PostProcess.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+PostProcess::PostProcess()
+    : fogEnabled{ false }, fogStart{ 0.0 }, fogEnd{ 1.0 }, tonemapEnabled{ false }, lutEnabled{ false }, vignetteEnabled{ false }, vignetteStrength{ 0.0 }, vignetteRadius{ 0.0 }
+{
+}
+
+void PostProcess::setFog(double fogStart, double fogEnd, Color fogColor)
+{
+    fogEnabled = true;
+    this->fogStart = fogStart;
+    this->fogEnd = fogEnd;
+    this->fogColor = PackedColor{ fogColor };
+}
+
+void PostProcess::disableFog()
+{
+    fogEnabled = false;
+}
+
+void PostProcess::setTonemap(double exposure, double whitePoint)
+{
+    tonemapEnabled = true;
+    double whiteSquared = whitePoint * whitePoint;
+    for (int i = 0; i < 256; i++)
+    {
+        double linear = pow(i / 255.0, 2.2) * exposure;
+        double mapped = linear * (1.0 + linear / whiteSquared) / (1.0 + linear);
+        double encoded = pow(std::min(mapped, 1.0), 1.0 / 2.2);
+        toneTable[i] = (uint8_t) (encoded * 255.0 + 0.5);
+    }
+}
+
+void PostProcess::disableTonemap()
+{
+    tonemapEnabled = false;
+}
+
+bool PostProcess::setColorLut(int size, const std::vector<PackedColor>& lut)
+{
+    if (size < 2 || lut.size() != (size_t) size * size * size)
+        return false;
+    lutEnabled = true;
+    this->lut.resize(size * size * size);
+    for (int i = 0; i < this->lut.size(); i++)
+        this->lut[i] = lut[i].rgba;
+
+    lutAxes.resize(3 * 256);
+    int strides[3] = { 1, size, size * size };
+    for (int channel = 0; channel < 3; channel++)
+        for (int value = 0; value < 256; value++)
+        {
+            int position = (value * (size - 1) * 256 + 127) / 255;
+            int cell = position >> 8;
+            LutAxis& axis = lutAxes[channel * 256 + value];
+            axis.offset = cell * strides[channel];
+            axis.step = cell < size - 1 ? strides[channel] : 0;
+            axis.weight = position & 0xFF;
+        }
+    return true;
+}
+
+void PostProcess::disableColorLut()
+{
+    lutEnabled = false;
+}
+
+std::vector<PackedColor> PostProcess::identityLut(int size)
+{
+    std::vector<PackedColor> lut;
+    if (size < 2)
+        return lut;
+    lut.reserve(size * size * size);
+    for (int b = 0; b < size; b++)
+        for (int g = 0; g < size; g++)
+            for (int r = 0; r < size; r++)
+            {
+                auto level = [size](int i) { return (i * 255 + (size - 1) / 2) / (size - 1); };
+                lut.push_back(PackedColor{ Color{ level(r), level(g), level(b), 255 } });
+            }
+    return lut;
+}
+
+void PostProcess::setVignette(double strength, double radius)
+{
+    vignetteEnabled = true;
+    vignetteStrength = strength;
+    vignetteRadius = radius;
+}
+
+void PostProcess::disableVignette()
+{
+    vignetteEnabled = false;
+}
+
+bool PostProcess::isEmpty() const
+{
+    return !fogEnabled && !tonemapEnabled && !lutEnabled && !vignetteEnabled;
+}
+
+void PostProcess::apply(Raster& image, const DepthBuffer& depth, ThreadPool& threadPool) const
+{
+    if (isEmpty())
+        return;
+
+    // Squared horizontal distance from the center for every column, padded
+    // so that partial quads at the end of a row can still load four lanes
+    int width = image.getWidth();
+    int height = image.getHeight();
+    std::vector<float> columnDistances(width + 3, 0.0f);
+    double halfDiagonal = sqrt(width * width + height * height) * 0.5;
+    for (int x = 0; x < width; x++)
+    {
+        double dx = (x + 0.5 - width * 0.5) / halfDiagonal;
+        columnDistances[x] = (float) (dx * dx);
+    }
+
+    const int rowsPerJob = 16;
+    threadPool.run((height + rowsPerJob - 1) / rowsPerJob, [&](int job)
+    {
+        int y0 = job * rowsPerJob;
+        applyRows(image, depth, y0, std::min(y0 + rowsPerJob, height), columnDistances);
+    });
+}
+
+void PostProcess::applyRows(Raster& image, const DepthBuffer& depth, int y0, int y1, const std::vector<float>& columnDistances) const
+{
+    // Everything the loop reads is copied into locals first, so the pixel
+    // stores can't force it to be reloaded
+    bool fog = fogEnabled;
+    bool tonemap = tonemapEnabled;
+    bool grade = lutEnabled;
+    bool vignette = vignetteEnabled;
+    const uint8_t* tones = toneTable;
+    const uint32_t* lutData = lut.data();
+    const LutAxis* axes = lutAxes.data();
+
+    Int4 colorMask{ 0x00FFFFFF };
+    Int4 alphaMask{ (int) 0xFF000000 };
+    Int4 fogPixel{ (int) fogColor.rgba };
+    Float4 fogOffset{ (float) fogStart };
+    Float4 fogScale{ (float) (256.0 / std::max(fogEnd - fogStart, 1e-6)) };
+    Float4 zero{ 0.0f };
+    Float4 one{ 1.0f };
+    Float4 three{ 3.0f };
+    Float4 fullWeight{ 256.0f };
+    Float4 radius{ (float) vignetteRadius };
+    Float4 falloffScale{ (float) (1.0 / std::max(1.0 - vignetteRadius, 1e-6)) };
+    Float4 strength{ (float) vignetteStrength };
+
+    int width = image.getWidth();
+    int height = image.getHeight();
+    double halfDiagonal = sqrt(width * width + height * height) * 0.5;
+    uint32_t* pixels = image.getPixels();
+
+    // Depth is converted a run at a time, so its format is dispatched once
+    // per run rather than per pixel
+    const int runLength = 64;
+    float distances[runLength] = {};
+
+    for (int y = y0; y < y1; y++)
+    {
+        int row = image.getPixelIndex(0, y);
+        double dy = (y + 0.5 - height * 0.5) / halfDiagonal;
+        Float4 rowDistance{ (float) (dy * dy) };
+        for (int runStart = 0; runStart < width; runStart += runLength)
+        {
+            int count = std::min(runLength, width - runStart);
+            if (fog)
+                depth.getDistances(row + runStart, count, distances);
+            for (int i = 0; i < count; i += 4)
+            {
+                // Only the last quad of a row can be partial
+                int lanes = std::min(4, count - i);
+                int* quad = reinterpret_cast<int*>(pixels + row + runStart + i);
+                int colors[4] = { 0, 0, 0, 0 };
+                if (lanes < 4)
+                    std::memcpy(colors, quad, lanes * sizeof(int));
+                Int4 original = Int4::load(lanes < 4 ? colors : quad);
+                Int4 color = original;
+
+                if (fog)
+                {
+                    Float4 amount = min(max((Float4::load(distances + i) - fogOffset) * fogScale, zero), fullWeight);
+                    color = blend(color, fogPixel, toInt(amount));
+                }
+                if (tonemap)
+                {
+                    color.store(colors);
+                    auto toneMap = [tones](int color)
+                    {
+                        uint32_t pixel = (uint32_t) color;
+                        return (int) (tones[pixel & 0xFF] | tones[pixel >> 8 & 0xFF] << 8 | tones[pixel >> 16 & 0xFF] << 16);
+                    };
+                    color = Int4{ toneMap(colors[0]), toneMap(colors[1]), toneMap(colors[2]), toneMap(colors[3]) };
+                }
+                if (grade)
+                    color = applyLut(color, lutData, axes);
+                if (vignette)
+                {
+                    Float4 distance = sqrt(Float4::load(&columnDistances[runStart + i]) + rowDistance);
+                    Float4 t = min(max((distance - radius) * falloffScale, zero), one);
+                    Float4 factor = one - strength * t * t * (three - t - t);
+                    color = modulate(color, factor, factor, factor);
+                }
+
+                Int4 result = (color & colorMask) | (original & alphaMask);
+                if (lanes < 4)
+                {
+                    result.store(colors);
+                    std::memcpy(quad, colors, lanes * sizeof(int));
+                }
+                else
+                    result.store(quad);
+            }
+        }
+    }
+}
+
+Int4 PostProcess::applyLut(Int4 pixels, const uint32_t* lut, const LutAxis* axes)
+{
+    // The eight lattice corners around every lane are gathered, then
+    // blended along red, green and blue in turn. Vectors are built from
+    // scalars rather than stored and reloaded, which would stall store
+    // forwarding
+    int colors[4];
+    pixels.store(colors);
+
+    struct Lane
+    {
+        int corners[8];
+        int weights[3];
+    };
+    auto setupLane = [lut, axes](int color)
+    {
+        uint32_t pixel = (uint32_t) color;
+        const LutAxis& red = axes[pixel & 0xFF];
+        const LutAxis& green = axes[256 + (pixel >> 8 & 0xFF)];
+        const LutAxis& blue = axes[512 + (pixel >> 16 & 0xFF)];
+        const uint32_t* cell = lut + red.offset + green.offset + blue.offset;
+        int r = red.step;
+        int g = green.step;
+        int b = blue.step;
+        return Lane
+        {
+            {
+                (int) cell[0], (int) cell[r], (int) cell[g], (int) cell[r + g],
+                (int) cell[b], (int) cell[r + b], (int) cell[g + b], (int) cell[r + g + b]
+            },
+            { red.weight, green.weight, blue.weight }
+        };
+    };
+    Lane lanes[4] = { setupLane(colors[0]), setupLane(colors[1]), setupLane(colors[2]), setupLane(colors[3]) };
+    auto corners = [&lanes](int corner)
+    {
+        return Int4{ lanes[0].corners[corner], lanes[1].corners[corner], lanes[2].corners[corner], lanes[3].corners[corner] };
+    };
+    auto weights = [&lanes](int channel)
+    {
+        return Int4{ lanes[0].weights[channel], lanes[1].weights[channel], lanes[2].weights[channel], lanes[3].weights[channel] };
+    };
+
+    Int4 weightR = weights(0);
+    Int4 weightG = weights(1);
+    Int4 g0b0 = blend(corners(0), corners(1), weightR);
+    Int4 g1b0 = blend(corners(2), corners(3), weightR);
+    Int4 g0b1 = blend(corners(4), corners(5), weightR);
+    Int4 g1b1 = blend(corners(6), corners(7), weightR);
+    return blend(blend(g0b0, g1b0, weightG), blend(g0b1, g1b1, weightG), weights(2));
+}
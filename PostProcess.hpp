@@ -0,0 +1,82 @@
+#ifndef POSTPROCESS_HPP
+#define POSTPROCESS_HPP
+
+#include "Raster.hpp"
+#include "DepthBuffer.hpp"
+#include "ThreadPool.hpp"
+#include "Simd.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// A chain of full-screen effects, applied in this order: depth fog,
+// exposure and tonemapping, a color grading LUT, then vignetting. All the
+// enabled stages run fused in one pass over the color and depth buffers,
+// four pixels at a time and split across threads by rows, so the memory
+// traffic does not grow with the number of effects. Alpha is kept
+class PostProcess
+{
+public:
+    PostProcess();
+
+    // Blends linearly towards fogColor between fogStart and fogEnd, in the
+    // distance units of DepthBuffer::getDistance. A fogEnd at or before
+    // fogStart makes the fog a hard cut at fogStart
+    void setFog(double fogStart, double fogEnd, Color fogColor);
+    void disableFog();
+
+    // Scales linear light by exposure, then compresses it with an extended
+    // Reinhard curve that maps whitePoint to full brightness. Colors are
+    // taken to be gamma 2.2 encoded on both ends
+    void setTonemap(double exposure, double whitePoint);
+    void disableTonemap();
+
+    // A size x size x size lattice of output colors, red varying fastest,
+    // then green, then blue, and sampled trilinearly. See identityLut. size
+    // must be at least 2 and lut hold exactly size^3 colors, otherwise
+    // nothing changes and the result is false
+    bool setColorLut(int size, const std::vector<PackedColor>& lut);
+    void disableColorLut();
+    // Empty for a size below 2
+    static std::vector<PackedColor> identityLut(int size);
+
+    // Darkens by up to strength towards the corners, starting at radius,
+    // which is a fraction of the distance from the center to a corner
+    void setVignette(double strength, double radius);
+    void disableVignette();
+
+    bool isEmpty() const;
+
+    void apply(Raster& image, const DepthBuffer& depth, ThreadPool& threadPool) const;
+private:
+    bool fogEnabled;
+    double fogStart;
+    double fogEnd;
+    PackedColor fogColor;
+
+    // Exposure and the tone curve, folded into one lookup per channel
+    bool tonemapEnabled;
+    uint8_t toneTable[256];
+
+    // Where each 8-bit channel value falls in the lattice: the offset of
+    // its cell, the offset to the next cell along that axis, and the
+    // position inside the cell as a 0 - 255 weight. One table per channel
+    struct LutAxis
+    {
+        int offset;
+        int step;
+        int weight;
+    };
+    bool lutEnabled;
+    std::vector<uint32_t> lut;
+    std::vector<LutAxis> lutAxes;
+
+    bool vignetteEnabled;
+    double vignetteStrength;
+    double vignetteRadius;
+
+    void applyRows(Raster& image, const DepthBuffer& depth, int y0, int y1, const std::vector<float>& columnDistances) const;
+    static Int4 applyLut(Int4 pixels, const uint32_t* lut, const LutAxis* axes);
+};
+
+#endif
@@ -1,5 +1,9 @@
 #include "Raster.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
 Raster::Raster()
     : Raster{ 0, 0 }
 {
@@ -11,32 +15,231 @@ Raster::Raster(int width, int height)
 }
 
 Raster::Raster(int width, int height, Color color)
-    : width{ width }, height{ height }, size(width * height * 4)
+    : width{ width }, height{ height }, ownsPixels{ true }, layout{ Layout::LINEAR }
 {
-    data = new uint8_t[size];
+    int count = buildOffsets();
+    size = count * 4;
+    pixels = new uint32_t[count];
     clear(color);
 }
 
+Raster::Raster(int width, int height, uint32_t* storage)
+    : width{ width }, height{ height }, pixels{ storage }, ownsPixels{ false }, opaque{ true }, layout{ Layout::LINEAR }
+{
+    size = buildOffsets() * 4;
+}
+
 Raster::~Raster()
 {
-    delete[] data;
+    if (ownsPixels)
+        delete[] pixels;
 }
 
 void Raster::clear(Color color)
 {
-    for (int i = 0; i < size; i += 4)
+    opaque = color.a > 0;
+    std::fill(pixels, pixels + size / 4, PackedColor{ color }.rgba);
+}
+
+void Raster::loadFromBuffer(const uint8_t* buffer)
+{
+    const uint32_t* source = reinterpret_cast<const uint32_t*>(buffer);
+    opaque = true;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            uint32_t pixel;
+            std::memcpy(&pixel, source + x + y * width, sizeof(pixel));
+            pixels[columnOffsets[x] + rowOffsets[y]] = pixel;
+            if (PackedColor{ pixel }.getAlpha() == 0)
+                opaque = false;
+        }
+}
+
+bool Raster::savePpm(std::string file) const
+{
+    std::ofstream output{ file, std::ios::binary };
+    output << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<uint8_t> row(width * 3);
+    for (int y = 0; y < height; y++)
     {
-        data[i + 0] = color.r;
-        data[i + 1] = color.g;
-        data[i + 2] = color.b;
-        data[i + 3] = color.a;
+        for (int x = 0; x < width; x++)
+        {
+            uint32_t pixel = pixels[columnOffsets[x] + rowOffsets[y]];
+            row[x * 3 + 0] = pixel & 0xFF;
+            row[x * 3 + 1] = pixel >> 8 & 0xFF;
+            row[x * 3 + 2] = pixel >> 16 & 0xFF;
+        }
+        output.write(reinterpret_cast<const char*>(row.data()), row.size());
     }
+    return (bool) output;
 }
 
-void Raster::loadFromBuffer(const uint8_t* buffer)
+bool Raster::saveRaw(std::string file) const
+{
+    std::ofstream output{ file, std::ios::binary };
+    if (layout == Layout::LINEAR)
+        output.write(reinterpret_cast<const char*>(pixels), width * height * sizeof(uint32_t));
+    else
+    {
+        std::vector<uint32_t> row(width);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+                row[x] = pixels[columnOffsets[x] + rowOffsets[y]];
+            output.write(reinterpret_cast<const char*>(row.data()), width * sizeof(uint32_t));
+        }
+    }
+    return (bool) output;
+}
+
+void Raster::setLayout(Layout layout)
+{
+    if (layout == this->layout || !ownsPixels)
+        return;
+
+    std::vector<uint32_t> linear(width * height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            linear[x + y * width] = pixels[columnOffsets[x] + rowOffsets[y]];
+
+    this->layout = layout;
+    int count = buildOffsets();
+    delete[] pixels;
+    size = count * 4;
+    pixels = new uint32_t[count];
+    std::fill(pixels, pixels + count, 0);
+
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            pixels[columnOffsets[x] + rowOffsets[y]] = linear[x + y * width];
+
+    for (std::unique_ptr<Raster>& mipmap : mipmaps)
+        mipmap->setLayout(layout);
+}
+
+Raster::Layout Raster::getLayout() const
+{
+    return layout;
+}
+
+void Raster::generateMipmaps()
+{
+    mipmaps.clear();
+    const Raster* source = this;
+    while (source->width > 1 || source->height > 1)
+    {
+        int levelWidth = std::max(source->width / 2, 1);
+        int levelHeight = std::max(source->height / 2, 1);
+        std::unique_ptr<Raster> level{ new Raster{ levelWidth, levelHeight } };
+        level->setLayout(layout);
+        level->opaque = source->opaque;
+
+        // Each texel averages the 2x2 block above it. When a side of the
+        // source is odd its last row or column is folded into the block
+        // before it, so nothing is dropped
+        for (int y = 0; y < levelHeight; y++)
+        {
+            int y0 = std::min(y * 2, source->height - 1);
+            int y1 = y == levelHeight - 1 ? source->height - 1 : std::min(y * 2 + 1, source->height - 1);
+            for (int x = 0; x < levelWidth; x++)
+            {
+                int x0 = std::min(x * 2, source->width - 1);
+                int x1 = x == levelWidth - 1 ? source->width - 1 : std::min(x * 2 + 1, source->width - 1);
+                int sums[4] = { 0, 0, 0, 0 };
+                int count = 0;
+                for (int sy = y0; sy <= y1; sy++)
+                    for (int sx = x0; sx <= x1; sx++)
+                    {
+                        uint32_t pixel = source->pixels[source->columnOffsets[sx] + source->rowOffsets[sy]];
+                        for (int channel = 0; channel < 4; channel++)
+                            sums[channel] += pixel >> (channel * 8) & 0xFF;
+                        count++;
+                    }
+                uint32_t average = 0;
+                for (int channel = 0; channel < 4; channel++)
+                    average |= (uint32_t) ((sums[channel] + count / 2) / count) << (channel * 8);
+                level->pixels[level->columnOffsets[x] + level->rowOffsets[y]] = average;
+            }
+        }
+
+        mipmaps.push_back(std::move(level));
+        source = mipmaps.back().get();
+    }
+}
+
+void Raster::clearMipmaps()
 {
-    for (int i = 0; i < size; i++)
-        data[i] = buffer[i];
+    mipmaps.clear();
+}
+
+int Raster::getLevelCount() const
+{
+    return 1 + (int) mipmaps.size();
+}
+
+const Raster& Raster::getLevel(int level) const
+{
+    return level == 0 ? *this : *mipmaps[level - 1];
+}
+
+int Raster::buildOffsets()
+{
+    columnOffsets.resize(width);
+    rowOffsets.resize(height);
+
+    switch (layout)
+    {
+    case Layout::LINEAR:
+        for (int x = 0; x < width; x++)
+            columnOffsets[x] = x;
+        for (int y = 0; y < height; y++)
+            rowOffsets[y] = y * width;
+        return width * height;
+    case Layout::TILED:
+    {
+        const int tileSize = 4;
+        int tilesX = (width + tileSize - 1) / tileSize;
+        int tilesY = (height + tileSize - 1) / tileSize;
+        for (int x = 0; x < width; x++)
+            columnOffsets[x] = x / tileSize * tileSize * tileSize + x % tileSize;
+        for (int y = 0; y < height; y++)
+            rowOffsets[y] = (y / tileSize * tilesX * tileSize + y % tileSize) * tileSize;
+        return tilesX * tilesY * tileSize * tileSize;
+    }
+    case Layout::MORTON:
+    {
+        // Both sides are padded to powers of two. The low bits of x and y
+        // are interleaved over the square part, and whichever side is
+        // longer appends its remaining bits on top
+        int paddedWidth = 1;
+        while (paddedWidth < width)
+            paddedWidth <<= 1;
+        int paddedHeight = 1;
+        while (paddedHeight < height)
+            paddedHeight <<= 1;
+        int squareBits = 0;
+        while ((1 << (squareBits + 1)) <= std::min(paddedWidth, paddedHeight))
+            squareBits++;
+
+        auto spread = [squareBits](int value)
+        {
+            int spreadValue = 0;
+            for (int bit = 0; bit < squareBits; bit++)
+                spreadValue |= (value >> bit & 1) << (2 * bit);
+            return spreadValue | (value >> squareBits) << (2 * squareBits);
+        };
+        for (int x = 0; x < width; x++)
+            columnOffsets[x] = spread(x);
+        for (int y = 0; y < height; y++)
+        {
+            int low = y & ((1 << squareBits) - 1);
+            rowOffsets[y] = spread(low) << 1 | (y >> squareBits) << (2 * squareBits);
+        }
+        return paddedWidth * paddedHeight;
+    }
+    }
+    return 0;
 }
 
 int Raster::getWidth() const
@@ -51,10 +254,25 @@ int Raster::getHeight() const
 
 const uint8_t* Raster::getData() const
 {
-    return data;
+    return reinterpret_cast<const uint8_t*>(pixels);
 }
 
 int Raster::getSize() const
 {
     return size;
+}
+
+const uint32_t* Raster::getPixels() const
+{
+    return pixels;
+}
+
+uint32_t* Raster::getPixels()
+{
+    return pixels;
+}
+
+bool Raster::isOpaque() const
+{
+    return opaque;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define RASTER_HPP
 
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 struct Color
@@ -22,65 +24,181 @@ struct Color
     int r, g, b, a;
 };
 
+// A color packed into one RGBA8 word with red in the lowest byte, which on
+// little-endian targets matches Raster's byte layout. This is what travels
+// through the pixel pipeline
+struct PackedColor
+{
+    PackedColor() : rgba{ 0xFF000000 } {}
+
+    explicit PackedColor(uint32_t rgba)
+        : rgba{ rgba } {}
+
+    // Channels are expected to be in 0 - 255 already, see Color::limit
+    PackedColor(Color color)
+        : rgba{ (uint32_t) (uint8_t) color.r | (uint32_t) (uint8_t) color.g << 8 | (uint32_t) (uint8_t) color.b << 16 | (uint32_t) (uint8_t) color.a << 24 } {}
+
+    Color unpack() const
+    {
+        return Color{ (int) (rgba & 0xFF), (int) (rgba >> 8 & 0xFF), (int) (rgba >> 16 & 0xFF), (int) (rgba >> 24) };
+    }
+
+    int getAlpha() const
+    {
+        return rgba >> 24;
+    }
+
+    uint32_t rgba;
+};
+
 class Raster
 {
 public:
+    // Memory order of the pixels. LINEAR is row-major and is what render
+    // targets and getData consumers expect. The others keep texels that
+    // are close in 2D close in memory, for textures sampled at an angle:
+    // TILED stores 4x4 blocks of one cache line each, MORTON stores the
+    // whole texture in Z-order
+    enum class Layout
+    {
+        LINEAR, TILED, MORTON
+    };
+
     Raster();
     Raster(int width, int height);
     Raster(int width, int height, Color color);
+    // Draws into width * height words owned by someone else, such as a
+    // slot of a shared-memory ring. The raster is LINEAR, never frees the
+    // memory and ignores setLayout
+    Raster(int width, int height, uint32_t* storage);
+    ~Raster();
 
     void clear(Color color);
 
     void setPixel(int x, int y, Color color)
     {
-        int index = getIndex(x, y);
-        if (!checkIndex(index))
-            return;
-        data[index + 0] = color.r;
-        data[index + 1] = color.g;
-        data[index + 2] = color.b;
-        data[index + 3] = color.a;
+        setPixel(getIndex(x, y), color);
     }
     void setPixel(int index, Color color)
     {
         if (!checkIndex(index))
             return;
-        data[index + 0] = color.r;
-        data[index + 1] = color.g;
-        data[index + 2] = color.b;
-        data[index + 3] = color.a;
+        if ((uint8_t) color.a == 0)
+            opaque = false;
+        pixels[index >> 2] = PackedColor{ color }.rgba;
     }
     Color getPixel(int x, int y) const
     {
-        int index = getIndex(x, y);
-        if (!checkIndex(index))
-            return Color{ 0, 0, 0, 255 };
-        return Color{ data[index + 0], data[index + 1], data[index + 2], data[index + 3] };
+        return getPixel(getIndex(x, y));
     }
     Color getPixel(int index) const
     {
         if (!checkIndex(index))
             return Color{ 0, 0, 0, 255 };
-        return Color{ data[index + 0], data[index + 1], data[index + 2], data[index + 3] };
+        return PackedColor{ pixels[index >> 2] }.unpack();
     }
+    // Byte offset of a pixel, as used by getPixel and setPixel. -1 outside
+    // the raster
     int getIndex(int x, int y) const
     {
-        return (x + y * width) << 2;
+        if (x < 0 || x >= width || y < 0 || y >= height)
+            return -1;
+        return (columnOffsets[x] + rowOffsets[y]) << 2;
+    }
+
+    // Unchecked packed access for the pixel pipeline, indexed by pixel
+    // rather than byte. setPacked does not update isOpaque, and
+    // getPixelIndex assumes the LINEAR layout, so they are meant for render
+    // targets
+    int getPixelIndex(int x, int y) const
+    {
+        return x + y * width;
+    }
+    PackedColor getPacked(int pixelIndex) const
+    {
+        return PackedColor{ pixels[pixelIndex] };
+    }
+    void setPacked(int pixelIndex, PackedColor color)
+    {
+        pixels[pixelIndex] = color.rgba;
     }
 
+    // Texture fetch in any layout: coordinates are clamped to the edge
+    // instead of checked
+    PackedColor getPixelClamped(int x, int y) const
+    {
+        x = x < 0 ? 0 : x >= width ? width - 1 : x;
+        y = y < 0 ? 0 : y >= height ? height - 1 : y;
+        return PackedColor{ getTexel(x, y) };
+    }
+    // Unchecked fetch in any layout, for samplers that have already
+    // wrapped the coordinates into the raster
+    uint32_t getTexel(int x, int y) const
+    {
+        return pixels[columnOffsets[x] + rowOffsets[y]];
+    }
+
+    // Takes row-major RGBA bytes whatever the layout
     void loadFromBuffer(const uint8_t* buffer);
 
+    // Write the pixels row-major whatever the layout: binary PPM drops
+    // alpha, raw is four RGBA bytes per pixel with no header. False if the
+    // file couldn't be written
+    bool savePpm(std::string file) const;
+    bool saveRaw(std::string file) const;
+
+    // Reorders the pixels in place, along with any mipmaps
+    void setLayout(Layout layout);
+    Layout getLayout() const;
+
+    // Builds the mip chain down to 1x1 by box-filtering each level from
+    // the one above it. Levels halve with rounding down, so texel
+    // coordinates of level 0 map to a level by scaling with the ratio of
+    // their sizes. The chain is not kept in sync with later pixel writes;
+    // call it again after changing the texture
+    void generateMipmaps();
+    void clearMipmaps();
+    // Level 0 is the raster itself
+    int getLevelCount() const;
+    const Raster& getLevel(int level) const;
+
     int getWidth() const;
     int getHeight() const;
-    const std::vector<uint8_t>& getData() const;
+    const uint8_t* getData() const;
+    int getSize() const;
+
+    // The storage as one RGBA8 word per pixel, in the raster's layout and
+    // including any padding it needs. Writes through it do not update
+    // isOpaque
+    const uint32_t* getPixels() const;
+    uint32_t* getPixels();
+
+    // False once any pixel may have zero alpha (and so fail the alpha test)
+    bool isOpaque() const;
 private:
     int width;
     int height;
-    std::vector<uint8_t> data;
+    int size;
+    uint32_t* pixels;
+    bool ownsPixels;
+    bool opaque;
+
+    // A pixel lives at columnOffsets[x] + rowOffsets[y]; every layout
+    // separates that way
+    Layout layout;
+    std::vector<int> columnOffsets;
+    std::vector<int> rowOffsets;
+
+    // Levels 1 and up
+    std::vector<std::unique_ptr<Raster>> mipmaps;
+
+    // Builds the offset tables for the current layout and returns the
+    // number of pixels of storage it needs
+    int buildOffsets();
 
     bool checkIndex(int index) const
     {
-        return index >= 0 && index < data.size();
+        return index >= 0 && index < size;
     }
 };
 
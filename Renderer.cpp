@@ -1,20 +1,45 @@
 #include "Renderer.hpp"
 
-Renderer::Renderer(Raster* image)
-    : image{ image }
+Renderer::Renderer(Raster* image, int threadCount)
+    : image{ image }, depth{ image->getWidth() * image->getHeight(), DepthBuffer::Format::FLOAT64 }, texturingEnabled{ true }, lodThreshold{ 1.0 }, perspectiveCorrection{ PerspectiveCorrection::PER_PIXEL }, mipmapSelection{ MipmapSelection::NONE }, rasterizer{ Rasterizer::SCANLINE }, threadPool{ threadCount }, binningEnabled{ false }, tileSize{ 64 }, fastClearsEnabled{ false }, clearsPending{ false }, activeRasterizer{ nullptr }, activeState{ 0 }
 {
     clearDepth();
     enableDepthTest(true);
+    resizeBins();
+
+    guardBandX = 1.0 + 2.0 * guardBandPixels / image->getWidth();
+    guardBandY = 1.0 + 2.0 * guardBandPixels / image->getHeight();
+}
+
+void Renderer::setImage(Raster* image)
+{
+    // Clears still pending belong to the old target
+    resolveClears();
+    this->image = image;
+}
+
+Raster* Renderer::getImage() const
+{
+    return image;
 }
 
 void Renderer::clearColor(Color color)
 {
-    image->clear(color);
+    if (fastClearsEnabled)
+    {
+        pendingClearColor = PackedColor{ color };
+        markClears(pendingColor);
+    }
+    else
+        image->clear(color);
 }
 
 void Renderer::clearDepth()
 {
-    depth.assign(image->getWidth() * image->getHeight(), 1.0e100);
+    if (fastClearsEnabled)
+        markClears(pendingDepth);
+    else
+        depth.clear();
 }
 
 void Renderer::clearColorDepth(Color color)
@@ -23,206 +48,852 @@ void Renderer::clearColorDepth(Color color)
     clearDepth();
 }
 
-void Renderer::fogPostProcess(double fogStart, double fogEnd, Color fogColor)
+void Renderer::enableFastClears(bool enable)
 {
-    int pixelIndex = 0;
-    for (int i = 0; i < depth.size(); i++)
-    {
-        double d = depth[i];
-        double fogAmount = (d - fogStart) / (fogEnd - fogStart);
-        fogAmount = fogAmount > 1.0 ? 1.0 : fogAmount < 0.0 ? 0.0 : fogAmount;
-        double keptAmount = 1.0 - fogAmount;
-        Color pixel = image->getPixel(pixelIndex);
-        pixel.r = (int) (pixel.r * keptAmount + fogColor.r * fogAmount);
-        pixel.g = (int) (pixel.g * keptAmount + fogColor.g * fogAmount);
-        pixel.b = (int) (pixel.b * keptAmount + fogColor.b * fogAmount);
-        image->setPixel(pixelIndex, pixel);
-        pixelIndex += 4;
+    if (!enable)
+        resolveClears();
+    fastClearsEnabled = enable;
+}
+
+void Renderer::resolveClears()
+{
+    if (!clearsPending)
+        return;
+    threadPool.run(pendingClears.size(), [this](int tileIndex)
+    {
+        resolveTile(tileIndex);
+    });
+    clearsPending = false;
+}
+
+void Renderer::markClears(int pending)
+{
+    for (uint8_t& tile : pendingClears)
+        tile |= pending;
+    clearsPending = true;
+}
+
+void Renderer::resolveTile(int tileIndex)
+{
+    int pending = pendingClears[tileIndex];
+    if (!pending)
+        return;
+    pendingClears[tileIndex] = 0;
+
+    Tile tile = getTile(tileIndex);
+    int count = tile.x1 - tile.x0;
+    uint32_t* pixels = image->getPixels();
+    for (int y = tile.y0; y < tile.y1; y++)
+    {
+        int index = image->getPixelIndex(tile.x0, y);
+        if (pending & pendingColor)
+            std::fill(pixels + index, pixels + index + count, pendingClearColor.rgba);
+        if (pending & pendingDepth)
+            depth.clear(index, count);
     }
 }
 
+void Renderer::postProcess(const PostProcess& chain)
+{
+    resolveClears();
+    chain.apply(*image, depth, threadPool);
+}
+
+void Renderer::fogPostProcess(double fogStart, double fogEnd, Color fogColor)
+{
+    PostProcess chain;
+    chain.setFog(fogStart, fogEnd, fogColor);
+    postProcess(chain);
+}
+
 void Renderer::enableDepthTest(bool enable)
 {
     depthTestEnabled = enable;
 }
 
-void Renderer::renderMesh(Mesh& mesh, const Raster& texture, const Transform& transform, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting)
+void Renderer::enableTexturing(bool enable)
+{
+    texturingEnabled = enable;
+}
+
+void Renderer::setSampler(Sampler sampler)
 {
-    const std::vector<Vertex>& vertices = mesh.getVertices();
-    const std::vector<Triangle>& triangles = mesh.getTriangles();
-    const std::vector<Vector3>& faceNormals = mesh.getFaceNormals();
+    this->sampler = sampler;
+}
 
-    if (verticesCopy.size() < vertices.size())
-        verticesCopy.resize(vertices.size());
-    if (renderFace.size() < triangles.size())
-        renderFace.resize(triangles.size());
+Sampler Renderer::getSampler() const
+{
+    return sampler;
+}
+
+void Renderer::setPerspectiveCorrection(PerspectiveCorrection perspectiveCorrection)
+{
+    this->perspectiveCorrection = perspectiveCorrection;
+}
 
-    // Model transform (and lighting calculations)
-    for (int i = 0; i < vertices.size(); i++)
+Renderer::PerspectiveCorrection Renderer::getPerspectiveCorrection() const
+{
+    return perspectiveCorrection;
+}
+
+int Renderer::getSpanLength(PerspectiveCorrection perspectiveCorrection)
+{
+    switch (perspectiveCorrection)
     {
-        Vertex v = vertices[i];
-        v.xyz = transform.apply(v.xyz);
-        v.normal = transform.applyNormal(v.normal);
-        v.normal.norm();
+    case PerspectiveCorrection::SPAN_8:
+        return 8;
+    case PerspectiveCorrection::SPAN_16:
+        return 16;
+    default:
+        return 0;
+    }
+}
 
-        if (lighting == Lighting::DIFFUSE)
+void Renderer::setMipmapSelection(MipmapSelection mipmapSelection)
+{
+    this->mipmapSelection = mipmapSelection;
+}
+
+Renderer::MipmapSelection Renderer::getMipmapSelection() const
+{
+    return mipmapSelection;
+}
+
+void Renderer::setDepthFormat(DepthBuffer::Format format)
+{
+    depth.setFormat(format);
+}
+
+DepthBuffer::Format Renderer::getDepthFormat() const
+{
+    return depth.getFormat();
+}
+
+void Renderer::setRasterizer(Rasterizer rasterizer)
+{
+    this->rasterizer = rasterizer;
+}
+
+Renderer::Rasterizer Renderer::getRasterizer() const
+{
+    return rasterizer;
+}
+
+void Renderer::enableBinning(bool enable)
+{
+    binningEnabled = enable;
+}
+
+void Renderer::setTileSize(int tileSize)
+{
+    resolveClears();
+    this->tileSize = tileSize;
+    resizeBins();
+}
+
+void Renderer::setThreadCount(int threadCount)
+{
+    threadPool.setThreadCount(threadCount);
+}
+
+void Renderer::resizeBins()
+{
+    tilesX = (image->getWidth() + tileSize - 1) / tileSize;
+    tilesY = (image->getHeight() + tileSize - 1) / tileSize;
+    tileBins.resize(tilesX * tilesY);
+    pendingClears.assign(tilesX * tilesY, 0);
+}
+
+Renderer::Tile Renderer::getTile(int tileIndex) const
+{
+    int tx = tileIndex % tilesX;
+    int ty = tileIndex / tilesX;
+    return Tile
+    {
+        tx * tileSize, ty * tileSize,
+        std::min((tx + 1) * tileSize, image->getWidth()),
+        std::min((ty + 1) * tileSize, image->getHeight())
+    };
+}
+
+Renderer::Tile Renderer::getTileRange(const ScreenTriangle& triangle) const
+{
+    const Vector3& p0 = triangle.v0.xyz;
+    const Vector3& p1 = triangle.v1.xyz;
+    const Vector3& p2 = triangle.v2.xyz;
+    double minX = fmin(p0.x, fmin(p1.x, p2.x));
+    double maxX = fmax(p0.x, fmax(p1.x, p2.x));
+    double minY = fmin(p0.y, fmin(p1.y, p2.y));
+    double maxY = fmax(p0.y, fmax(p1.y, p2.y));
+
+    int maxPixelX = image->getWidth() - 1;
+    int maxPixelY = image->getHeight() - 1;
+    int tileX0 = std::clamp((int) floor(minX), 0, maxPixelX) / tileSize;
+    int tileX1 = std::clamp((int) floor(maxX), 0, maxPixelX) / tileSize;
+    int tileY0 = std::clamp((int) floor(minY), 0, maxPixelY) / tileSize;
+    int tileY1 = std::clamp((int) floor(maxY), 0, maxPixelY) / tileSize;
+    return Tile{ tileX0, tileY0, tileX1 + 1, tileY1 + 1 };
+}
+
+void Renderer::binTriangle(const ScreenTriangle& triangle)
+{
+    Tile range = getTileRange(triangle);
+    int index = binnedTriangles.size();
+    binnedTriangles.push_back(triangle);
+    for (int ty = range.y0; ty < range.y1; ty++)
+        for (int tx = range.x0; tx < range.x1; tx++)
+            tileBins[tx + ty * tilesX].push_back(index);
+}
+
+void Renderer::flushBins(const Raster& texture)
+{
+    threadPool.run(tileBins.size(), [this, &texture](int tileIndex)
+    {
+        std::vector<int>& bin = tileBins[tileIndex];
+        if (bin.empty())
+            return;
+        // A pending clear is carried out right before the tile is drawn,
+        // while its memory is about to be touched anyway
+        resolveTile(tileIndex);
+        Tile tile = getTile(tileIndex);
+        for (int i = 0; i < bin.size(); i++)
         {
-            Vector3 lightAccum;
-            for (int j = 0; j < lights.size(); j++)
-            {
-                LightSource light = lights[j];
-                switch (light.type)
-                {
-                case LightType::POINT:
-                {
-                    Vector3 vertexToLight{ light.point.position };
-                    vertexToLight.sub(v.xyz);
-                    double dot = vertexToLight.dot(v.normal);
-                    double len = vertexToLight.len();
-                    double brightness = fmax(0.0, dot / len);
-                    double dim = fmax(0.0, 1.0 - len / light.point.attenuation);
-                    Vector3 lightColor = light.point.color;
-                    lightColor.scl(brightness * dim);
-                    lightAccum.add(lightColor);
-                    break;
-                }
-                case LightType::DIRECTIONAL:
-                {
-                    Vector3 dir = light.directional.direction;
-                    dir.scl(-1.0);
-                    double dot = dir.dot(v.normal);
-                    double brightness = fmax(0.0, dot / dir.len());
-                    Vector3 lightColor = light.directional.color;
-                    lightColor.scl(brightness);
-                    lightAccum.add(lightColor);
-                    break;
-                }
-                case LightType::AMBIENT:
-                {
-                    Vector3 lightColor = light.ambient.color;
-                    lightAccum.add(lightColor);
-                    break;
-                }
-                }
-            }
-            v.rgb.mul(lightAccum);
+            const ScreenTriangle& triangle = binnedTriangles[bin[i]];
+            rasterizeTriangle(triangle.v0, triangle.v1, triangle.v2, texture.getLevel(triangle.mipLevel), tile);
         }
+        bin.clear();
+    });
+    binnedTriangles.clear();
+}
 
-        verticesCopy[i] = v;
-    }
+void Renderer::ViewStreams::resize(int size)
+{
+    std::vector<float>* arrays[] =
+    {
+        &x, &y, &z, &r, &g, &b,
+        &projX, &projY, &projZ, &projR, &projG, &projB, &projU, &projV
+    };
+    for (std::vector<float>* array : arrays)
+        if (array->size() < size)
+            array->resize(size);
+    if (clipCodes.size() < size)
+        clipCodes.resize(size);
+}
 
-    // Backface culling
+Renderer::PipelineState Renderer::getPipelineVariant(int variant)
+{
+    return PipelineState
+    {
+        (variant & pipelineOrthographic) != 0,
+        (variant & pipelineDepthTest) != 0,
+        (variant & pipelineTextured) != 0,
+        (variant & pipelineAlphaTest) != 0
+    };
+}
+
+Renderer::PipelineState Renderer::getPipelineState(const Raster& texture, const Camera& camera) const
+{
+    return PipelineState
+    {
+        camera.getOrthographic(),
+        depthTestEnabled,
+        texturingEnabled,
+        texturingEnabled && !texture.isOpaque()
+    };
+}
+
+void Renderer::renderMesh(Mesh& mesh, const Raster& texture, const Transform& transform, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting)
+{
+    renderMesh(mesh, texture, transform, camera, lights, lighting, getPipelineState(texture, camera));
+}
+
+void Renderer::setLodThreshold(double lodThreshold)
+{
+    this->lodThreshold = lodThreshold;
+}
+
+double Renderer::getLodThreshold() const
+{
+    return lodThreshold;
+}
+
+int Renderer::selectLod(const MeshLod& lods, const Transform& transform, const Camera& camera) const
+{
+    Matrix4 modelView = camera.getTransform().toMatrix();
+    modelView.mul(transform.toMatrix());
+
+    // Errors grow with the largest stretch of the model transform
+    const Matrix3& linear = modelView.getLinear();
+    double scale = 0.0;
+    for (int col = 0; col < 3; col++)
+        scale = std::max(scale, Vector3{ linear.m[0][col], linear.m[1][col], linear.m[2][col] }.len());
+
+    Bounds bounds = lods.getBounds();
+    Vector3 center = bounds.min;
+    center.add(bounds.max);
+    center.scl(0.5);
+    Vector3 extent = bounds.max;
+    extent.sub(bounds.min);
+    double radius = extent.len() * 0.5 * scale;
+
+    // One view unit at distance d spans width / (2 * perspective * d)
+    // pixels, as in applyPerspective
+    double pixelsPerUnit;
     if (camera.getOrthographic())
+        pixelsPerUnit = image->getWidth() * 0.5 / camera.getFov();
+    else
     {
-        Vector3 camDir = camera.getForwardVec();
-        for (int i = 0; i < triangles.size(); i++)
-        {
-            Vector3 normal = transform.applyNormal(faceNormals[i]);
-            renderFace[i] = camDir.dot(normal) < 0.0;
-        }
+        double distance = std::max(modelView.apply(center).len() - radius, camera.getNearClip());
+        pixelsPerUnit = image->getWidth() * 0.5 / (camera.getPerspective() * distance);
     }
+    return lods.selectLevel(pixelsPerUnit * scale, lodThreshold);
+}
+
+void Renderer::renderMesh(MeshLod& lods, const Raster& texture, const Transform& transform, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting)
+{
+    renderMesh(lods.getLevel(selectLod(lods, transform, camera)), texture, transform, camera, lights, lighting);
+}
+
+void Renderer::renderMesh(Mesh& mesh, const Raster& texture, const Transform& transform, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting, PipelineState state)
+{
+    static const std::array<TriangleRasterizer, pipelineVariantCount> scanlineKernels =
+        scanlineVariants(std::make_integer_sequence<int, pipelineVariantCount>{});
+    static const std::array<TriangleRasterizer, pipelineVariantCount> edgeFunctionKernels =
+        edgeFunctionVariants(std::make_integer_sequence<int, pipelineVariantCount>{});
+
+    int variant = (state.orthographic ? pipelineOrthographic : 0) |
+        (state.depthTest ? pipelineDepthTest : 0) |
+        (state.textured ? pipelineTextured : 0) |
+        (state.alphaTest ? pipelineAlphaTest : 0);
+    activeRasterizer = rasterizer == Rasterizer::SCANLINE ? scanlineKernels[variant] : edgeFunctionKernels[variant];
+    activeState = variant;
+
+    const MeshStreams& streams = mesh.getStreams();
+    const Triangle* triangles = streams.triangles;
+
+    viewStreams.resize(streams.paddedVertexCount);
+    if (renderFace.size() < streams.triangleCount)
+        renderFace.resize(streams.triangleCount);
+
+    if (camera.getOrthographic())
+        depth.setOrthographic(camera.getFarClip());
     else
+        depth.setPerspective(camera.getNearClip() * camera.getPerspective());
+
+    // Both transform chains are flattened and fused into one model-view
+    // matrix, so every vertex costs a single matrix multiply
+    Matrix4 view = camera.getTransform().toMatrix();
+    Matrix4 modelView = view;
+    modelView.mul(transform.toMatrix());
+
+    // Whole meshlets outside the view or facing away skip everything below
+    cullMeshlets(streams, modelView, camera);
+
+    // Model-view transform, lighting and projection in one pass
+    transformVertices(streams, texture, modelView, view, camera, lights, lighting);
+
+    // Backface culling
+    cullFaces(streams, modelView, camera);
+
+    // Triangle clipping and rasterization
+    for (int i = 0; i < streams.triangleCount; i++)
     {
-        Vector3 view = camera.getPosition();
-        for (int i = 0; i < triangles.size(); i++)
+        if (!renderFace[i])
+            continue;
+
+        Triangle tri = triangles[i];
+        int code0 = viewStreams.clipCodes[tri.v0];
+        int code1 = viewStreams.clipCodes[tri.v1];
+        int code2 = viewStreams.clipCodes[tri.v2];
+        if (code0 & code1 & code2)
+            continue;
+
+        Vertex projected[3] = { getProjectedVertex(tri.v0), getProjectedVertex(tri.v1), getProjectedVertex(tri.v2) };
+        if (((code0 | code1 | code2) & (clipNear | clipFar | clipGuardBand)) == 0)
         {
-            Vector3 p0 = verticesCopy[triangles[i].v0].xyz;
-            Vector3 diff = p0;
-            diff.sub(view);
-            Vector3 normal = transform.applyNormal(faceNormals[i]);
-            renderFace[i] = diff.dot(normal) < 0.0;
+            submitTriangle(projected[0], projected[1], projected[2], texture);
+            continue;
         }
+
+        Vertex view[3] = { getViewVertex(streams, tri.v0), getViewVertex(streams, tri.v1), getViewVertex(streams, tri.v2) };
+        clipTriangle(view, projected, texture, camera);
     }
 
-    // View transform
-    for (int i = 0; i < vertices.size(); i++)
+    if (binningEnabled)
+        flushBins(texture);
+}
+
+void Renderer::transformVertices(const MeshStreams& streams, const Raster& texture, const Matrix4& modelView, const Matrix4& view, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting)
+{
+    // Light parameters are reduced once per draw: ambient lights sum into a
+    // constant, directional lights become a normalized vector towards the light.
+    // The camera transform is rigid, so lighting can be done in view space
+    // with the lights moved there instead of the vertices
+    struct PointLightBatch
+    {
+        Float4 x, y, z;
+        Float4 r, g, b;
+        Float4 oneOverAttenuation;
+    };
+    struct DirectionalLightBatch
     {
-        Vertex v = verticesCopy[i];
-        v.xyz = camera.getTransform().apply(v.xyz);
-        verticesCopy[i] = v;
+        Float4 x, y, z;
+        Float4 r, g, b;
+    };
+    Vector3 ambient;
+    std::vector<PointLightBatch> pointLights;
+    std::vector<DirectionalLightBatch> directionalLights;
+    for (int i = 0; i < lights.size(); i++)
+    {
+        const LightSource& light = lights[i];
+        switch (light.type)
+        {
+        case LightType::POINT:
+        {
+            const PointLight& point = light.point;
+            Vector3 position = view.apply(point.position);
+            pointLights.push_back(PointLightBatch
+            {
+                Float4{ (float) position.x }, Float4{ (float) position.y }, Float4{ (float) position.z },
+                Float4{ (float) point.color.x }, Float4{ (float) point.color.y }, Float4{ (float) point.color.z },
+                Float4{ (float) (1.0 / point.attenuation) }
+            });
+            break;
+        }
+        case LightType::DIRECTIONAL:
+        {
+            const DirectionalLight& directional = light.directional;
+            Vector3 dir = view.applyNormal(directional.direction);
+            dir.scl(-1.0 / dir.len());
+            directionalLights.push_back(DirectionalLightBatch
+            {
+                Float4{ (float) dir.x }, Float4{ (float) dir.y }, Float4{ (float) dir.z },
+                Float4{ (float) directional.color.x }, Float4{ (float) directional.color.y }, Float4{ (float) directional.color.z }
+            });
+            break;
+        }
+        case LightType::AMBIENT:
+            ambient.add(light.ambient.color);
+            break;
+        }
     }
-    
-    // Don't do near clipping for orthographic, start with left clip
-    ClipPlane startClipPlane = camera.getOrthographic() ? ClipPlane::LEFT : ClipPlane::NEAR;
-    
-    // Triangle recursive clipping and rasterization
-    for (int i = 0; i < triangles.size(); i++)
+
+    Float4 zero{ 0.0f };
+    Float4 one{ 1.0f };
+
+    // Projection matches applyPerspective
+    bool ortho = camera.getOrthographic();
+    Float4 perspective{ (float) camera.getPerspective() };
+    Float4 aspect{ (float) camera.getAspect() };
+    Float4 oneOverFov{ (float) (1.0 / camera.getFov()) };
+    Float4 textureWidth{ (float) texture.getWidth() };
+    Float4 textureHeight{ (float) texture.getHeight() };
+    Float4 nearZ{ (float) -camera.getNearClip() };
+    Float4 farZ{ (float) -camera.getFarClip() };
+    Float4 viewportMin{ -1.0f };
+    Float4 viewportMax{ 1.0f };
+    Float4 guardBandMinX{ (float) -guardBandX };
+    Float4 guardBandMaxX{ (float) guardBandX };
+    Float4 guardBandMinY{ (float) -guardBandY };
+    Float4 guardBandMaxY{ (float) guardBandY };
+
+    auto transformBlock = [&](int i)
     {
-        Triangle tri = triangles[i];
-        Vertex v0 = verticesCopy[tri.v0];
-        Vertex v1 = verticesCopy[tri.v1];
-        Vertex v2 = verticesCopy[tri.v2];
+        Float4 x = Float4::load(&streams.x[i]);
+        Float4 y = Float4::load(&streams.y[i]);
+        Float4 z = Float4::load(&streams.z[i]);
+        modelView.applyBatch(x, y, z);
 
-        if (renderFace[i])
-            doTriangle(v0, v1, v2, startClipPlane, texture, camera);
-    }
+        Float4 r = Float4::load(&streams.r[i]);
+        Float4 g = Float4::load(&streams.g[i]);
+        Float4 b = Float4::load(&streams.b[i]);
+
+        if (lighting == Lighting::DIFFUSE)
+        {
+            Float4 nx = Float4::load(&streams.nx[i]);
+            Float4 ny = Float4::load(&streams.ny[i]);
+            Float4 nz = Float4::load(&streams.nz[i]);
+            modelView.applyNormalBatch(nx, ny, nz);
+            Float4 oneOverLength = one / sqrt(nx * nx + ny * ny + nz * nz);
+            nx = nx * oneOverLength;
+            ny = ny * oneOverLength;
+            nz = nz * oneOverLength;
+
+            Float4 lightR{ (float) ambient.x };
+            Float4 lightG{ (float) ambient.y };
+            Float4 lightB{ (float) ambient.z };
+            for (const DirectionalLightBatch& light : directionalLights)
+            {
+                Float4 brightness = max(zero, light.x * nx + light.y * ny + light.z * nz);
+                lightR = lightR + light.r * brightness;
+                lightG = lightG + light.g * brightness;
+                lightB = lightB + light.b * brightness;
+            }
+            for (const PointLightBatch& light : pointLights)
+            {
+                Float4 toLightX = light.x - x;
+                Float4 toLightY = light.y - y;
+                Float4 toLightZ = light.z - z;
+                Float4 dot = toLightX * nx + toLightY * ny + toLightZ * nz;
+                Float4 len = sqrt(toLightX * toLightX + toLightY * toLightY + toLightZ * toLightZ);
+                Float4 brightness = max(zero, dot / len);
+                Float4 dim = max(zero, one - len * light.oneOverAttenuation);
+                Float4 amount = brightness * dim;
+                lightR = lightR + light.r * amount;
+                lightG = lightG + light.g * amount;
+                lightB = lightB + light.b * amount;
+            }
+            r = r * lightR;
+            g = g * lightG;
+            b = b * lightB;
+        }
+
+        x.store(&viewStreams.x[i]);
+        y.store(&viewStreams.y[i]);
+        z.store(&viewStreams.z[i]);
+        r.store(&viewStreams.r[i]);
+        g.store(&viewStreams.g[i]);
+        b.store(&viewStreams.b[i]);
+
+        Float4 u = Float4::load(&streams.u[i]) * textureWidth;
+        Float4 v = (one - Float4::load(&streams.v[i])) * textureHeight;
+        Float4 projX, projY, projZ;
+        int behind = 0;
+        if (ortho)
+        {
+            projX = x * oneOverFov;
+            projY = y * aspect * oneOverFov;
+            projZ = zero - z;
+        }
+        else
+        {
+            behind = movemask(z > nearZ);
+            Float4 oneOverZ = one / (perspective * (zero - z));
+            projX = x * oneOverZ;
+            projY = y * oneOverZ * aspect;
+            projZ = oneOverZ;
+            r = r * oneOverZ;
+            g = g * oneOverZ;
+            b = b * oneOverZ;
+            u = u * oneOverZ;
+            v = v * oneOverZ;
+        }
+        projX.store(&viewStreams.projX[i]);
+        projY.store(&viewStreams.projY[i]);
+        projZ.store(&viewStreams.projZ[i]);
+        r.store(&viewStreams.projR[i]);
+        g.store(&viewStreams.projG[i]);
+        b.store(&viewStreams.projB[i]);
+        u.store(&viewStreams.projU[i]);
+        v.store(&viewStreams.projV[i]);
+
+        int inFront = ~behind;
+        int masks[7] =
+        {
+            behind,
+            movemask(z < farZ),
+            movemask(projX < viewportMin) & inFront,
+            movemask(projX > viewportMax) & inFront,
+            movemask(projY < viewportMin) & inFront,
+            movemask(projY > viewportMax) & inFront,
+            movemask(projX < guardBandMinX) | movemask(projX > guardBandMaxX) |
+                movemask(projY < guardBandMinY) | movemask(projY > guardBandMaxY)
+        };
+        for (int lane = 0; lane < 4; lane++)
+        {
+            int code = 0;
+            for (int bit = 0; bit < 7; bit++)
+                code |= ((masks[bit] >> lane) & 1) << bit;
+            viewStreams.clipCodes[i + lane] = code;
+        }
+    };
+
+    // Large meshes are split across the thread pool in fixed-size chunks
+    const int chunkSize = 1024;
+    int paddedCount = streams.paddedVertexCount;
+    int chunkCount = (paddedCount + chunkSize - 1) / chunkSize;
+    threadPool.run(chunkCount, [&](int chunk)
+    {
+        int end = std::min((chunk + 1) * chunkSize, paddedCount);
+        for (int i = chunk * chunkSize; i < end; i += 4)
+            if (activeBlocks[i >> 2])
+                transformBlock(i);
+    });
 }
 
-Renderer::TriangleClip Renderer::clipTriangle(Vertex v0, Vertex v1, Vertex v2, ClipPlane plane, const Camera& camera) const
+void Renderer::cullMeshlets(const MeshStreams& streams, const Matrix4& modelView, const Camera& camera)
 {
-    EdgeClip v0v1 = clipEdge(v0, v1, plane, camera);
-    EdgeClip v1v2 = clipEdge(v1, v2, plane, camera);
-    EdgeClip v2v0 = clipEdge(v2, v0, plane, camera);
+    bool hasMeshlets = streams.meshletCount > 0;
+    activeBlocks.assign(streams.paddedVertexCount / 4, hasMeshlets ? 0 : 1);
+    meshletVisible.assign(streams.meshletCount, 0);
+    if (!hasMeshlets)
+        return;
 
-    if (v0v1.result == EdgeClip::ClipResult::REMOVED
-        && v1v2.result == EdgeClip::ClipResult::REMOVED
-        && v2v0.result == EdgeClip::ClipResult::REMOVED)
-        return TriangleClip{ TriangleClip::ClipResult::REMOVED, {}, {} };
+    // Spheres are tested against the view frustum in view space, scaled by
+    // the largest stretch of the transform
+    const Matrix3& linear = modelView.getLinear();
+    double scale = 0.0;
+    for (int col = 0; col < 3; col++)
+        scale = std::max(scale, Vector3{ linear.m[0][col], linear.m[1][col], linear.m[2][col] }.len());
+    bool ortho = camera.getOrthographic();
+    double nearClip = camera.getNearClip();
+    double farClip = camera.getFarClip();
+    double slopeX = ortho ? camera.getFov() : camera.getPerspective();
+    double slopeY = slopeX / camera.getAspect();
+    double oneOverLengthX = 1.0 / sqrt(1.0 + slopeX * slopeX);
+    double oneOverLengthY = 1.0 / sqrt(1.0 + slopeY * slopeY);
 
-    if (v0v1.result == EdgeClip::ClipResult::KEPT
-        && v1v2.result == EdgeClip::ClipResult::KEPT
-        && v2v0.result == EdgeClip::ClipResult::KEPT)
-        return TriangleClip{ TriangleClip::ClipResult::KEPT, { v0, v1, v2 }, {} };
+    // Cones are tested in model space. With C the cofactor matrix of the
+    // linear part L, which is what normals are transformed by, and t the
+    // translation, cullFaces looks at the sign of
+    // dot(Lp + t, Cn) = det(L) * dot(p - eye, n), where eye = -L^-1 t is
+    // the camera in model space, or for orthographic views at that of
+    // (Cn).z = dot(n, the last row of C)
+    Matrix3 cofactor = linear.cofactor();
+    double determinant = linear.m[0][0] * cofactor.m[0][0] + linear.m[0][1] * cofactor.m[0][1] + linear.m[0][2] * cofactor.m[0][2];
+    Vector3 translation = modelView.apply(Vector3{ 0.0, 0.0, 0.0 });
+    Vector3 eye;
+    Vector3 viewAxis{ cofactor.m[2][0], cofactor.m[2][1], cofactor.m[2][2] };
+    if (determinant != 0.0)
+        eye = Vector3
+        {
+            -(cofactor.m[0][0] * translation.x + cofactor.m[1][0] * translation.y + cofactor.m[2][0] * translation.z) / determinant,
+            -(cofactor.m[0][1] * translation.x + cofactor.m[1][1] * translation.y + cofactor.m[2][1] * translation.z) / determinant,
+            -(cofactor.m[0][2] * translation.x + cofactor.m[1][2] * translation.y + cofactor.m[2][2] * translation.z) / determinant
+        };
+    viewAxis.norm();
+    // Leaves a margin for the float math of cullFaces
+    const double epsilon = 1e-4;
 
-    if (v0v1.result == EdgeClip::ClipResult::CLIPPED)
+    auto facesAway = [&](const Meshlet& meshlet)
     {
-        std::swap(v0v1, v1v2);
-        std::swap(v0, v2);
-    }
-    if (v0v1.result == EdgeClip::ClipResult::CLIPPED)
+        if (meshlet.coneCos <= 0.0 || determinant == 0.0)
+            return false;
+        double coneSin = sqrt(1.0 - meshlet.coneCos * meshlet.coneCos);
+        if (ortho)
+        {
+            // Every normal is more than 90 degrees from the view axis
+            double axisCos = meshlet.coneAxis.dot(viewAxis);
+            double axisSin = sqrt(std::max(0.0, 1.0 - axisCos * axisCos));
+            return axisCos * meshlet.coneCos + axisSin * coneSin < -epsilon;
+        }
+
+        // The normal closest to pointing at any point of the sphere still
+        // points away from it
+        Vector3 toCenter = meshlet.center;
+        toCenter.sub(eye);
+        double distance = toCenter.len();
+        if (distance <= meshlet.radius)
+            return false;
+        double axisCos = meshlet.coneAxis.dot(toCenter) / distance * (determinant > 0.0 ? 1.0 : -1.0);
+        double axisSin = sqrt(std::max(0.0, 1.0 - axisCos * axisCos));
+        return distance * (axisCos * meshlet.coneCos - axisSin * coneSin) > meshlet.radius + epsilon * distance;
+    };
+
+    auto outsideView = [&](const Meshlet& meshlet)
     {
-        std::swap(v0v1, v2v0);
-        std::swap(v1, v2);
-    }
+        Vector3 center = modelView.apply(meshlet.center);
+        double radius = meshlet.radius * scale;
+        double depth = -center.z;
+        if (depth - radius > farClip)
+            return true;
+        if (ortho)
+            return fabs(center.x) - slopeX > radius || fabs(center.y) - slopeY > radius;
+        return depth + radius < nearClip ||
+            (fabs(center.x) - slopeX * depth) * oneOverLengthX > radius ||
+            (fabs(center.y) - slopeY * depth) * oneOverLengthY > radius;
+    };
 
-    if (v0v1.result == EdgeClip::ClipResult::REMOVED)
-        return TriangleClip{ TriangleClip::ClipResult::CLIPPED_ONE, { v1v2.v, v2v0.v, v2 }, {} };
-    else
-        return TriangleClip{ TriangleClip::ClipResult::CLIPPED_TWO, { v1v2.v, v2v0.v, v0 }, { v1v2.v, v0, v1 } };
+    for (int m = 0; m < streams.meshletCount; m++)
+    {
+        const Meshlet& meshlet = streams.meshlets[m];
+        if (outsideView(meshlet) || facesAway(meshlet))
+            continue;
+        meshletVisible[m] = 1;
+        int end = meshlet.triangleStart + meshlet.triangleCount;
+        for (int i = meshlet.triangleStart; i < end; i++)
+        {
+            const Triangle& triangle = streams.triangles[i];
+            activeBlocks[triangle.v0 >> 2] = 1;
+            activeBlocks[triangle.v1 >> 2] = 1;
+            activeBlocks[triangle.v2 >> 2] = 1;
+        }
+    }
+}
 
-    return TriangleClip{ TriangleClip::ClipResult::REMOVED, {}, {} };
+void Renderer::cullFaces(const MeshStreams& streams, const Matrix4& modelView, const Camera& camera)
+{
+    if (streams.meshletCount == 0)
+    {
+        cullFaces(streams, modelView, camera, 0, streams.triangleCount);
+        return;
+    }
+    for (int m = 0; m < streams.meshletCount; m++)
+    {
+        const Meshlet& meshlet = streams.meshlets[m];
+        int end = meshlet.triangleStart + meshlet.triangleCount;
+        if (meshletVisible[m])
+            cullFaces(streams, modelView, camera, meshlet.triangleStart, end);
+        else
+            for (int i = meshlet.triangleStart; i < end; i++)
+                renderFace[i] = false;
+    }
 }
 
-void Renderer::doTriangle(Vertex v0, Vertex v1, Vertex v2, ClipPlane plane, const Raster& texture, const Camera& camera)
+void Renderer::cullFaces(const MeshStreams& streams, const Matrix4& modelView, const Camera& camera, int start, int end)
 {
-    ClipPlane nextPlane = nextClipPlane(plane);
-    if (plane == ClipPlane::NONE)
-        rasterizeTriangle(v0, v1, v2, texture, camera);
-    else
+    // Culling happens in view space, where the camera sits at the origin
+    // looking down -z. Quads stay aligned to four triangles so the padded
+    // face arrays are never overrun, and lanes outside the range are left
+    // alone
+    bool ortho = camera.getOrthographic();
+    const Triangle* triangles = streams.triangles;
+    Float4 zero{ 0.0f };
+
+    for (int i = start & ~3; i < end; i += 4)
     {
-        if (plane == ClipPlane::LEFT)
+        Float4 nx = Float4::load(&streams.faceX[i]);
+        Float4 ny = Float4::load(&streams.faceY[i]);
+        Float4 nz = Float4::load(&streams.faceZ[i]);
+        modelView.applyNormalBatch(nx, ny, nz);
+
+        int facing;
+        if (ortho)
+            facing = movemask(nz > zero);
+        else
         {
-            v0 = applyPerspective(v0, texture, camera);
-            v1 = applyPerspective(v1, texture, camera);
-            v2 = applyPerspective(v2, texture, camera);
+            float px[4], py[4], pz[4];
+            for (int lane = 0; lane < 4; lane++)
+            {
+                int vertex = i + lane >= start && i + lane < end ? triangles[i + lane].v0 : 0;
+                px[lane] = viewStreams.x[vertex];
+                py[lane] = viewStreams.y[vertex];
+                pz[lane] = viewStreams.z[vertex];
+            }
+            Float4 dot = Float4::load(px) * nx + Float4::load(py) * ny + Float4::load(pz) * nz;
+            facing = movemask(dot < zero);
         }
-        TriangleClip clip = clipTriangle(v0, v1, v2, plane, camera);
-        switch (clip.result)
+
+        for (int lane = std::max(start - i, 0); lane < 4 && i + lane < end; lane++)
+            renderFace[i + lane] = facing & (1 << lane);
+    }
+}
+
+double Renderer::planeDistance(const Vertex& v, ClipPlane plane, const Camera& camera) const
+{
+    switch (plane)
+    {
+    case ClipPlane::NEAR:
+        return -v.xyz.z - camera.getNearClip();
+    case ClipPlane::FAR:
+        return camera.getFarClip() + v.xyz.z;
+    case ClipPlane::LEFT:
+        return guardBandX + v.xyz.x;
+    case ClipPlane::RIGHT:
+        return guardBandX - v.xyz.x;
+    case ClipPlane::BOTTOM:
+        return guardBandY + v.xyz.y;
+    case ClipPlane::TOP:
+        return guardBandY - v.xyz.y;
+    }
+    return 0.0;
+}
+
+int Renderer::clipPolygon(const ClipVertex* polygon, int count, ClipVertex* clipped, ClipPlane plane, const Camera& camera) const
+{
+    int clippedCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const Vertex& v0 = polygon[i].vertex;
+        const Vertex& v1 = polygon[i + 1 == count ? 0 : i + 1].vertex;
+        double d0 = planeDistance(v0, plane, camera);
+        double d1 = planeDistance(v1, plane, camera);
+        if (d0 >= 0.0)
+            clipped[clippedCount++] = polygon[i];
+        if ((d0 >= 0.0) != (d1 >= 0.0))
         {
-        case TriangleClip::ClipResult::CLIPPED_ONE:
-            doTriangle(clip.t0.v0, clip.t0.v1, clip.t0.v2, nextPlane, texture, camera);
-            break;
-        case TriangleClip::ClipResult::CLIPPED_TWO:
-            doTriangle(clip.t0.v0, clip.t0.v1, clip.t0.v2, nextPlane, texture, camera);
-            doTriangle(clip.t1.v0, clip.t1.v1, clip.t1.v2, nextPlane, texture, camera);
-            break;
-        case TriangleClip::ClipResult::KEPT:
-            doTriangle(v0, v1, v2, nextPlane, texture, camera);
-            break;
-        default:
-            break;
+            // Always interpolate from the inside vertex so that an edge
+            // shared by two triangles is cut at exactly the same point
+            LinearInterpolate lin;
+            if (d0 >= 0.0)
+                lin = LinearInterpolate{ v0, v1, d0 / (d0 - d1), 0.0 };
+            else
+                lin = LinearInterpolate{ v1, v0, d1 / (d1 - d0), 0.0 };
+            clipped[clippedCount++] = ClipVertex{ lin.value, -1 };
         }
     }
+    return clippedCount;
+}
+
+void Renderer::clipTriangle(const Vertex* view, const Vertex* projected, const Raster& texture, const Camera& camera)
+{
+    ClipVertex buffer0[maxClipVertices];
+    ClipVertex buffer1[maxClipVertices];
+    ClipVertex* polygon = buffer0;
+    ClipVertex* clipped = buffer1;
+    for (int i = 0; i < 3; i++)
+        polygon[i] = ClipVertex{ view[i], i };
+    int count = 3;
+
+    auto clip = [&](ClipPlane plane)
+    {
+        count = clipPolygon(polygon, count, clipped, plane, camera);
+        std::swap(polygon, clipped);
+    };
+
+    auto outside = [&](ClipPlane plane)
+    {
+        int outsideCount = 0;
+        for (int i = 0; i < count; i++)
+            if (planeDistance(polygon[i].vertex, plane, camera) < 0.0)
+                outsideCount++;
+        return outsideCount;
+    };
+
+    // Depth planes are clipped in view space. Orthographic has no near clip
+    ClipPlane depthPlanes[2] = { ClipPlane::NEAR, ClipPlane::FAR };
+    for (int i = camera.getOrthographic() ? 1 : 0; i < 2; i++)
+    {
+        int outsideCount = outside(depthPlanes[i]);
+        if (outsideCount == count)
+            return;
+        if (outsideCount > 0)
+            clip(depthPlanes[i]);
+    }
+
+    // Corners that survived keep the vertex stage's projection, so edges
+    // shared with unclipped triangles line up exactly
+    for (int i = 0; i < count; i++)
+    {
+        ClipVertex& v = polygon[i];
+        v.vertex = v.corner >= 0 ? projected[v.corner] : applyPerspective(v.vertex, texture, camera);
+    }
+
+    // Reject polygons entirely off one side of the viewport, then clip the
+    // rare ones that leave the guard band
+    bool left = true, right = true, bottom = true, top = true;
+    for (int i = 0; i < count; i++)
+    {
+        const Vector3& p = polygon[i].vertex.xyz;
+        left &= p.x < -1.0;
+        right &= p.x > 1.0;
+        bottom &= p.y < -1.0;
+        top &= p.y > 1.0;
+    }
+    if (left || right || bottom || top)
+        return;
+
+    ClipPlane screenPlanes[4] = { ClipPlane::LEFT, ClipPlane::RIGHT, ClipPlane::BOTTOM, ClipPlane::TOP };
+    for (int i = 0; i < 4; i++)
+    {
+        if (outside(screenPlanes[i]) > 0)
+            clip(screenPlanes[i]);
+        if (count < 3)
+            return;
+    }
+
+    for (int i = 1; i + 1 < count; i++)
+        submitTriangle(polygon[0].vertex, polygon[i].vertex, polygon[i + 1].vertex, texture);
 }
 
 Vertex Renderer::applyPerspective(Vertex v, const Raster& texture, const Camera& camera)
@@ -251,9 +922,9 @@ Vertex Renderer::applyPerspective(Vertex v, const Raster& texture, const Camera&
     return v;
 }
 
-void Renderer::rasterizeTriangle(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, const Camera& camera)
+void Renderer::submitTriangle(Vertex v0, Vertex v1, Vertex v2, const Raster& texture)
 {
-    auto toScreenSpace = [this, &texture](Vertex& vertex)
+    auto toScreenSpace = [this](Vertex& vertex)
     {
         vertex.xyz.x = image->getWidth() * 0.5 * (1.0 + vertex.xyz.x);
         vertex.xyz.y = image->getHeight() * 0.5 * (1.0 - vertex.xyz.y);
@@ -262,168 +933,532 @@ void Renderer::rasterizeTriangle(Vertex v0, Vertex v1, Vertex v2, const Raster&
     toScreenSpace(v1);
     toScreenSpace(v2);
 
-    if (v1.xyz.y < v0.xyz.y)
+    // Per-triangle mipmapping compares the triangle's area in texels to its
+    // area in pixels. Texture coordinates are rescaled to the chosen level
+    // here, so the kernels just sample the level they are given
+    int mipLevel = 0;
+    if (mipmapSelection == MipmapSelection::PER_TRIANGLE && (activeState & pipelineTextured) && texture.getLevelCount() > 1)
+    {
+        bool ortho = (activeState & pipelineOrthographic) != 0;
+        Vector2 uv[3] = { v0.uv, v1.uv, v2.uv };
+        if (!ortho)
+        {
+            uv[0].scl(1.0 / v0.xyz.z);
+            uv[1].scl(1.0 / v1.xyz.z);
+            uv[2].scl(1.0 / v2.xyz.z);
+        }
+        uv[1].sub(uv[0]);
+        uv[2].sub(uv[0]);
+        double texelArea = fabs(uv[1].x * uv[2].y - uv[2].x * uv[1].y);
+        double pixelArea = fabs((v1.xyz.x - v0.xyz.x) * (v2.xyz.y - v0.xyz.y) - (v2.xyz.x - v0.xyz.x) * (v1.xyz.y - v0.xyz.y));
+        if (pixelArea > 0.0)
+            mipLevel = selectMipLevel(texelArea / pixelArea, texture.getLevelCount());
+        if (mipLevel > 0)
+        {
+            MipLevel level = getMipLevel(texture, mipLevel);
+            Vector2 scale{ level.scaleX, level.scaleY };
+            v0.uv.mul(scale);
+            v1.uv.mul(scale);
+            v2.uv.mul(scale);
+        }
+    }
+
+    if (binningEnabled)
+    {
+        binTriangle(ScreenTriangle{ v0, v1, v2, mipLevel });
+        return;
+    }
+
+    if (clearsPending)
+    {
+        Tile range = getTileRange(ScreenTriangle{ v0, v1, v2, mipLevel });
+        for (int ty = range.y0; ty < range.y1; ty++)
+            for (int tx = range.x0; tx < range.x1; tx++)
+                resolveTile(tx + ty * tilesX);
+    }
+    rasterizeTriangle(v0, v1, v2, texture.getLevel(mipLevel), Tile{ 0, 0, image->getWidth(), image->getHeight() });
+}
+
+Renderer::Gradients::Gradients(const Vertex& v0, const Vertex& v1, const Vertex& v2)
+    : origin{ v0 }
+{
+    double x1 = v1.xyz.x - v0.xyz.x;
+    double y1 = v1.xyz.y - v0.xyz.y;
+    double x2 = v2.xyz.x - v0.xyz.x;
+    double y2 = v2.xyz.y - v0.xyz.y;
+    double oneOverArea = 1.0 / (x1 * y2 - x2 * y1);
+
+    auto gradient = [x1, y1, x2, y2, oneOverArea](double a0, double a1, double a2, double& ddx, double& ddy)
+    {
+        a1 -= a0;
+        a2 -= a0;
+        ddx = (a1 * y2 - a2 * y1) * oneOverArea;
+        ddy = (a2 * x1 - a1 * x2) * oneOverArea;
+    };
+    gradient(v0.xyz.z, v1.xyz.z, v2.xyz.z, dx.xyz.z, dy.xyz.z);
+    gradient(v0.rgb.x, v1.rgb.x, v2.rgb.x, dx.rgb.x, dy.rgb.x);
+    gradient(v0.rgb.y, v1.rgb.y, v2.rgb.y, dx.rgb.y, dy.rgb.y);
+    gradient(v0.rgb.z, v1.rgb.z, v2.rgb.z, dx.rgb.z, dy.rgb.z);
+    gradient(v0.uv.x, v1.uv.x, v2.uv.x, dx.uv.x, dy.uv.x);
+    gradient(v0.uv.y, v1.uv.y, v2.uv.y, dx.uv.y, dy.uv.y);
+}
+
+template<int State>
+void Renderer::rasterizeScanline(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, Tile tile)
+{
+    constexpr bool ortho = (State & pipelineOrthographic) != 0;
+    constexpr bool depthTest = (State & pipelineDepthTest) != 0;
+    constexpr bool textured = (State & pipelineTextured) != 0;
+    constexpr bool alphaTest = (State & pipelineAlphaTest) != 0;
+
+    SubPixel p0{ v0.xyz };
+    SubPixel p1{ v1.xyz };
+    SubPixel p2{ v2.xyz };
+    if (p1.y < p0.y)
+    {
+        std::swap(p0, p1);
         std::swap(v0, v1);
-    if (v2.xyz.y < v1.xyz.y)
+    }
+    if (p2.y < p1.y)
+    {
+        std::swap(p1, p2);
         std::swap(v1, v2);
-    if (v1.xyz.y < v0.xyz.y)
+    }
+    if (p1.y < p0.y)
+    {
+        std::swap(p0, p1);
         std::swap(v0, v1);
+    }
 
-    double t = getT(v0.xyz.y, v2.xyz.y, v1.xyz.y);
-    LinearInterpolate lin{ v0, v2, t, 0.0 };
-    Vertex v1l = lin.value;
-    Vertex v1r = v1;
-    if (v1r.xyz.x < v1l.xyz.x)
-        std::swap(v1l, v1r);
-
-    int yPixelStart;
-    int yPixelEnd;
-    double yDifference;
-    double yTInc;
-    double yStartT;
-    LinearInterpolate leftEdge;
-    LinearInterpolate rightEdge;
-    
-    bool ortho = camera.getOrthographic();
-    
-    auto scanline = [this, &texture, ortho]
-        (LinearInterpolate& leftEdge, LinearInterpolate& rightEdge, int y)
-    {
-        Vertex& lv = leftEdge.value;
-        Vertex& rv = rightEdge.value;
-        int xPixelStart = (int) floor(lv.xyz.x + 0.499);
-        int xPixelEnd = (int) floor(rv.xyz.x - 0.499);
-        double xDifference = rv.xyz.x - lv.xyz.x;
-        double xTInc = 1.0 / xDifference;
-        double xStartT = (xPixelStart + 0.5 - lv.xyz.x) * xTInc;
-        LinearInterpolate scanline{ lv, rv, xStartT, xTInc };
+    // Positive when v1 lies right of the long edge v0 -> v2
+    int64_t area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if (area == 0)
+        return;
+    bool longEdgeLeft = area > 0;
+
+    // Interpolate from the snapped positions so attributes line up with coverage
+    v0.xyz.x = p0.x / (double) subPixelScale;
+    v0.xyz.y = p0.y / (double) subPixelScale;
+    v1.xyz.x = p1.x / (double) subPixelScale;
+    v1.xyz.y = p1.y / (double) subPixelScale;
+    v2.xyz.x = p2.x / (double) subPixelScale;
+    v2.xyz.y = p2.y / (double) subPixelScale;
+    Gradients gradients{ v0, v1, v2 };
+
+    // Rows whose pixel centers lie in [p0.y, p2.y), split at p1.y
+    int yStart = std::max((int) ceilDiv(p0.y - subPixelHalf, subPixelScale), tile.y0);
+    int yMiddle = std::clamp((int) ceilDiv(p1.y - subPixelHalf, subPixelScale), tile.y0, tile.y1);
+    int yEnd = std::min((int) ceilDiv(p2.y - subPixelHalf, subPixelScale), tile.y1);
+    if (yStart >= yEnd)
+        return;
+
+    // Divides the perspective-scaled color and texture coordinates by the
+    // interpolated 1 / z
+    auto correct = [](const Vertex& v)
+    {
+        Vertex corrected = v;
+        if (!ortho)
+        {
+            double z = 1.0 / v.xyz.z;
+            corrected.rgb.scl(z);
+            if (textured)
+                corrected.uv.scl(z);
+        }
+        return corrected;
+    };
+
+    // Per-span mipmapping picks a level from the texel footprint at the
+    // start of each span. Otherwise the texture is sampled as given
+    bool mipPerSpan = textured && mipmapSelection == MipmapSelection::PER_SPAN && texture.getLevelCount() > 1;
+    MipLevel mip{ &texture, 1.0, 1.0 };
+    auto selectMip = [&texture, &gradients, &mip, mipPerSpan](const Vertex& value)
+    {
+        if (mipPerSpan)
+            mip = getMipLevel(texture, selectMipLevel(gradients.footprint(value, ortho), texture.getLevelCount()));
+    };
+
+    // A local copy, so the compiler need not reload it after every pixel
+    // store
+    Sampler textureSampler = sampler;
+    auto shade = [&textureSampler, &mip](const Vertex& corrected)
+    {
+        PackedColor pixel{ 0xFFFFFFFF };
+        if (textured)
+            pixel = PackedColor{ textureSampler.sample(*mip.texture, corrected.uv.x * mip.scaleX, corrected.uv.y * mip.scaleY) };
+        return PackedColor{ modulate(pixel.rgba, (float) corrected.rgb.x, (float) corrected.rgb.y, (float) corrected.rgb.z) };
+    };
+
+    int spanLength = ortho ? 0 : getSpanLength(perspectiveCorrection);
+
+    // Worst-case error of a linear run between two exact values whose 1 / z
+    // are w0 and w1, in texels, or in color levels when untextured. The
+    // interpolation parameter is off by at most (q - 1) / (q + 1) with
+    // q = sqrt(w1 / w0)
+    auto spanError = [](double w0, double w1, const Vertex& start, const Vertex& end)
+    {
+        double q = sqrt(w1 / w0);
+        double parameterError = fabs(q - 1.0) / (q + 1.0);
+        double range;
+        if (textured)
+            range = std::max(fabs(end.uv.x - start.uv.x), fabs(end.uv.y - start.uv.y));
+        else
+            range = 255.0 * std::max(fabs(end.rgb.x - start.rgb.x), std::max(fabs(end.rgb.y - start.rgb.y), fabs(end.rgb.z - start.rgb.z)));
+        return parameterError * range;
+    };
+
+    auto scanline = [this, &correct, &shade, &selectMip, &spanError, spanLength, &tile, &gradients](int xPixelStart, int xPixelEnd, int y)
+    {
+        xPixelStart = std::max(xPixelStart, tile.x0);
+        xPixelEnd = std::min(xPixelEnd, tile.x1);
+        if (xPixelStart >= xPixelEnd)
+            return;
+        LinearInterpolate scanline{ gradients.at(xPixelStart + 0.5, y + 0.5), gradients.dx };
         Vertex& v = scanline.value;
 
-        int pixelIndex = image->getIndex(xPixelStart, y);
-        int depthIndex = pixelIndex >> 2;
-        for (int x = xPixelStart; x <= xPixelEnd; x++)
+        // The depth buffer shares the image's pixel indices
+        int pixelIndex = image->getPixelIndex(xPixelStart, y);
+
+        // Depth is tested before the texture fetch, and before the divide.
+        // Opaque textures write depth right away; alpha-tested ones only
+        // once the texel is known to be kept
+        auto drawPixel = [&](auto getCorrected)
         {
-            double z;
-            Vector3 rgb;
-            Vector2 uv;
-            if (ortho)
+            if (!alphaTest)
             {
-                z = v.xyz.z;
-                rgb = v.rgb;
-                uv = v.uv;
+                if (testDepth<depthTest>(pixelIndex, v.xyz.z))
+                    image->setPacked(pixelIndex, shade(getCorrected()));
             }
-            else
+            else if (passesDepth<depthTest>(pixelIndex, v.xyz.z))
             {
-                z = 1.0 / v.xyz.z;
-                rgb = v.rgb;
-                rgb.scl(z);
-                uv = v.uv;
-                uv.scl(z);
+                PackedColor pixel = shade(getCorrected());
+                if (pixel.getAlpha() > 0)
+                {
+                    writeDepth(pixelIndex, v.xyz.z);
+                    image->setPacked(pixelIndex, pixel);
+                }
             }
+            scanline.step();
+            pixelIndex++;
+        };
 
-            Color pixel = texture.getPixel((int) uv.x, (int) uv.y);
-            pixel.r *= rgb.x;
-            pixel.g *= rgb.y;
-            pixel.b *= rgb.z;
-            pixel.limit();
+        if (spanLength == 0)
+        {
+            for (int x = xPixelStart; x < xPixelEnd; x++)
+            {
+                if ((x - xPixelStart) % mipSpanLength == 0)
+                    selectMip(v);
+                drawPixel([&]() { return correct(v); });
+            }
+            return;
+        }
 
-            if (pixel.a > 0 && testDepth(depthIndex, z))
-                image->setPixel(pixelIndex, pixel);
+        // Exact values at span boundaries, linear in between. The end of
+        // one span is the start of the next, so each span costs one divide
+        Vertex spanStart = correct(v);
+        bool spanStartValid = true;
+        for (int x = xPixelStart; x < xPixelEnd; )
+        {
+            int spanPixels = std::min(spanLength, xPixelEnd - x);
+            Vertex end = v;
+            Gradients::addScaled(end, gradients.dx, spanPixels);
+            if (!spanStartValid)
+                spanStart = correct(v);
+            selectMip(v);
 
-            scanline.step();
-            pixelIndex += 4;
-            depthIndex++;
+            Vertex spanEnd;
+            bool affine = false;
+            if (end.xyz.z > 0.0)
+            {
+                spanEnd = correct(end);
+                affine = spanError(v.xyz.z, end.xyz.z, spanStart, spanEnd) <= maxSpanError;
+            }
+            if (affine)
+            {
+                Vertex step;
+                step.rgb = spanEnd.rgb;
+                step.rgb.sub(spanStart.rgb);
+                step.rgb.scl(1.0 / spanPixels);
+                step.uv = spanEnd.uv;
+                step.uv.sub(spanStart.uv);
+                step.uv.scl(1.0 / spanPixels);
+                LinearInterpolate span{ spanStart, step };
+                for (int i = 0; i < spanPixels; i++)
+                {
+                    drawPixel([&]() { return span.value; });
+                    span.step();
+                }
+                spanStart = spanEnd;
+                spanStartValid = true;
+            }
+            else
+            {
+                // Too steep in depth for a linear run: divide every pixel
+                for (int i = 0; i < spanPixels; i++)
+                    drawPixel([&]() { return correct(v); });
+                spanStartValid = false;
+            }
+            x += spanPixels;
         }
-        leftEdge.step();
-        rightEdge.step();
     };
 
+    auto walkEdges = [&scanline, longEdgeLeft](EdgeWalker& longEdge, EdgeWalker& shortEdge, int yStart, int yEnd)
+    {
+        EdgeWalker& leftEdge = longEdgeLeft ? longEdge : shortEdge;
+        EdgeWalker& rightEdge = longEdgeLeft ? shortEdge : longEdge;
+        for (int y = yStart; y < yEnd; y++)
+        {
+            scanline((int) leftEdge.x, (int) rightEdge.x, y);
+            leftEdge.step();
+            rightEdge.step();
+        }
+    };
+
+    EdgeWalker longEdge{ p0, p2, yStart };
+
     // Top half
-    yPixelStart = (int) floor(v0.xyz.y + 0.5);
-    yPixelEnd = (int) floor(v1.xyz.y - 0.5);
-    yDifference = v1.xyz.y - v0.xyz.y;
-    yTInc = 1.0 / yDifference;
-    yStartT = (yPixelStart + 0.5 - v0.xyz.y) * yTInc;
-    leftEdge = LinearInterpolate{ v0, v1l, yStartT, yTInc };
-    rightEdge = LinearInterpolate{ v0, v1r, yStartT, yTInc };
-    for (int y = yPixelStart; y <= yPixelEnd; y++)
-        scanline(leftEdge, rightEdge, y);
+    if (yStart < yMiddle)
+    {
+        EdgeWalker shortEdge{ p0, p1, yStart };
+        walkEdges(longEdge, shortEdge, yStart, yMiddle);
+    }
 
     // Bottom half
-    yPixelStart = (int) floor(v2.xyz.y - 0.5);
-    yPixelEnd = (int) floor(v1.xyz.y + 0.5);
-    yDifference = v2.xyz.y - v1.xyz.y;
-    yTInc = 1.0 / yDifference;
-    yStartT = (v2.xyz.y - (yPixelStart + 0.5)) * yTInc;
-    leftEdge = LinearInterpolate{ v2, v1l, yStartT, yTInc };
-    rightEdge = LinearInterpolate{ v2, v1r, yStartT, yTInc };
-    for (int y = yPixelStart; y >= yPixelEnd; y--)
-        scanline(leftEdge, rightEdge, y);
+    int yBottom = std::max(yStart, yMiddle);
+    if (yBottom < yEnd)
+    {
+        if (yBottom != yStart)
+            longEdge = EdgeWalker{ p0, p2, yBottom };
+        EdgeWalker shortEdge{ p1, p2, yBottom };
+        walkEdges(longEdge, shortEdge, yBottom, yEnd);
+    }
 }
 
-Renderer::EdgeClip Renderer::clipEdge(Vertex v0, Vertex v1, ClipPlane plane, const Camera& camera) const
+template<int State>
+void Renderer::rasterizeEdgeFunction(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, Tile tile)
 {
-    auto sortClip = [&v0, &v1](double a, double b, double c, bool flipped)
+    constexpr bool ortho = (State & pipelineOrthographic) != 0;
+    constexpr bool depthTest = (State & pipelineDepthTest) != 0;
+    constexpr bool textured = (State & pipelineTextured) != 0;
+    constexpr bool alphaTest = (State & pipelineAlphaTest) != 0;
+
+    SubPixel p0{ v0.xyz };
+    SubPixel p1{ v1.xyz };
+    SubPixel p2{ v2.xyz };
+    int64_t area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if (area == 0)
+        return;
+    if (area < 0)
     {
-        if (b < a)
+        std::swap(p1, p2);
+        std::swap(v1, v2);
+    }
+
+    // Pixel centers inside the bounding box, clamped to the tile
+    int64_t minX = std::min(p0.x, std::min(p1.x, p2.x));
+    int64_t maxX = std::max(p0.x, std::max(p1.x, p2.x));
+    int64_t minY = std::min(p0.y, std::min(p1.y, p2.y));
+    int64_t maxY = std::max(p0.y, std::max(p1.y, p2.y));
+    int xMin = std::max((int) ceilDiv(minX - subPixelHalf, subPixelScale), tile.x0);
+    int xMax = std::min((int) floorDiv(maxX - subPixelHalf, subPixelScale), tile.x1 - 1);
+    int yMin = std::max((int) ceilDiv(minY - subPixelHalf, subPixelScale), tile.y0);
+    int yMax = std::min((int) floorDiv(maxY - subPixelHalf, subPixelScale), tile.y1 - 1);
+    if (xMin > xMax || yMin > yMax)
+        return;
+
+    v0.xyz.x = p0.x / (double) subPixelScale;
+    v0.xyz.y = p0.y / (double) subPixelScale;
+    v1.xyz.x = p1.x / (double) subPixelScale;
+    v1.xyz.y = p1.y / (double) subPixelScale;
+    v2.xyz.x = p2.x / (double) subPixelScale;
+    v2.xyz.y = p2.y / (double) subPixelScale;
+    Gradients gradients{ v0, v1, v2 };
+
+    // Integer edge function of a -> b, non-negative on covered pixel
+    // centers. Edges that aren't top or left are biased by -1 so that
+    // centers exactly on them are left to the neighbouring triangle
+    struct Edge
+    {
+        int64_t a, b, c;
+
+        int64_t at(int x, int y) const
         {
-            std::swap(a, b);
-            std::swap(v0, v1);
+            return a * (x * subPixelScale + subPixelHalf) + b * (y * subPixelScale + subPixelHalf) + c;
         }
-        if (flipped)
+    };
+    auto setupEdge = [](SubPixel from, SubPixel to)
+    {
+        Edge edge;
+        edge.a = from.y - to.y;
+        edge.b = to.x - from.x;
+        edge.c = -edge.a * from.x - edge.b * from.y;
+        bool topLeft = edge.a > 0 || (edge.a == 0 && edge.b > 0);
+        if (!topLeft)
+            edge.c--;
+        return edge;
+    };
+    Edge edges[3] = { setupEdge(p1, p2), setupEdge(p2, p0), setupEdge(p0, p1) };
+
+    // The bounding box is walked in aligned 8x8 blocks. Edges are classified
+    // per block in 64-bit; only edges that cross a block are evaluated per
+    // pixel, and those values are small enough for 32-bit lanes
+    const int blockSize = 8;
+    const int blockSpan = (blockSize - 1) * subPixelScale;
+
+    // Quad lanes are ordered (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1)
+    Float4 laneX{ 0.0f, 1.0f, 0.0f, 1.0f };
+    Float4 laneY{ 0.0f, 0.0f, 1.0f, 1.0f };
+
+    Float4 one{ 1.0f };
+
+    const Vertex& ddx = gradients.dx;
+    const Vertex& ddy = gradients.dy;
+    double attributeDx[6] = { ddx.xyz.z, ddx.rgb.x, ddx.rgb.y, ddx.rgb.z, ddx.uv.x, ddx.uv.y };
+    double attributeDy[6] = { ddy.xyz.z, ddy.rgb.x, ddy.rgb.y, ddy.rgb.z, ddy.uv.x, ddy.uv.y };
+    Float4 attributeLanes[6];
+    for (int i = 0; i < 6; i++)
+        attributeLanes[i] = laneX * Float4{ (float) attributeDx[i] } + laneY * Float4{ (float) attributeDy[i] };
+
+    // Per-span mipmapping picks a level per block, from the texel footprint
+    // at its center. Otherwise the texture is sampled as given
+    bool mipPerSpan = textured && mipmapSelection == MipmapSelection::PER_SPAN && texture.getLevelCount() > 1;
+    MipLevel mip{ &texture, 1.0, 1.0 };
+    Sampler textureSampler = sampler;
+
+    auto shadeQuad = [&](int x, int y, int mask, const Vertex& blockValue, int blockX, int blockY)
+    {
+        // Attributes are offset in float from the block origin, which is
+        // evaluated in double
+        double blockAttributes[6] = { blockValue.xyz.z, blockValue.rgb.x, blockValue.rgb.y, blockValue.rgb.z, blockValue.uv.x, blockValue.uv.y };
+        float depths[4];
+        int offsetX = x - blockX;
+        int offsetY = y - blockY;
+        auto interpolate = [&](int i)
         {
-            if (b < c)
-                return EdgeClip{ EdgeClip::ClipResult::KEPT, {} };
-            if (a > c)
-                return EdgeClip{ EdgeClip::ClipResult::REMOVED, {} };
-        }
-        else
+            float base = (float) (blockAttributes[i] + attributeDx[i] * offsetX + attributeDy[i] * offsetY);
+            return Float4{ base } + attributeLanes[i];
+        };
+
+        // Depth first, so that fully occluded quads skip the remaining
+        // attributes, the divide and the texture fetches
+        Float4 depthLanes = interpolate(0);
+        depthLanes.store(depths);
+        int pixelIndices[4];
+        for (int lane = 0; lane < 4; lane++)
         {
-            if (a > c)
-                return EdgeClip{ EdgeClip::ClipResult::KEPT, {} };
-            if (b < c)
-                return EdgeClip{ EdgeClip::ClipResult::REMOVED, {} };
+            if (!(mask & (1 << lane)))
+                continue;
+            pixelIndices[lane] = image->getPixelIndex(x + (lane & 1), y + (lane >> 1));
+            bool passed = alphaTest ? passesDepth<depthTest>(pixelIndices[lane], depths[lane]) : testDepth<depthTest>(pixelIndices[lane], depths[lane]);
+            if (!passed)
+                mask &= ~(1 << lane);
         }
+        if (!mask)
+            return;
 
-        LinearInterpolate lin;
-        double t = getT(a, b, c);
-        lin = LinearInterpolate{ v0, v1, t, 0.0 };
+        Float4 z = ortho ? one : one / depthLanes;
+
+        // The whole quad is sampled and modulated together; masked lanes
+        // read valid texels too, since the sampler wraps every coordinate
+        Int4 texels{ -1 };
+        if (textured)
+            texels = textureSampler.sample(*mip.texture, interpolate(4) * z * Float4{ (float) mip.scaleX }, interpolate(5) * z * Float4{ (float) mip.scaleY });
+        int shaded[4];
+        modulate(texels, interpolate(1) * z, interpolate(2) * z, interpolate(3) * z).store(shaded);
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (!(mask & (1 << lane)))
+                continue;
 
-        return EdgeClip{ EdgeClip::ClipResult::CLIPPED, lin.value };
+            PackedColor pixel{ (uint32_t) shaded[lane] };
+            if (!alphaTest)
+                image->setPacked(pixelIndices[lane], pixel);
+            else if (pixel.getAlpha() > 0)
+            {
+                writeDepth(pixelIndices[lane], depths[lane]);
+                image->setPacked(pixelIndices[lane], pixel);
+            }
+        }
     };
 
-    switch (plane)
+    for (int blockY = yMin & ~(blockSize - 1); blockY <= yMax; blockY += blockSize)
     {
-    case ClipPlane::NEAR:
-        return sortClip(v0.xyz.z, v1.xyz.z, -camera.getNearClip(), true);
-    case ClipPlane::LEFT:
-        return sortClip(v0.xyz.x, v1.xyz.x, -1.0, false);
-    case ClipPlane::RIGHT:
-        return sortClip(v0.xyz.x, v1.xyz.x, 1.0, true);
-    case ClipPlane::BOTTOM:
-        return sortClip(v0.xyz.y, v1.xyz.y, -1.0, false);
-    case ClipPlane::TOP:
-        return sortClip(v0.xyz.y, v1.xyz.y, 1.0, true);
-    case ClipPlane::NONE:
-        return { EdgeClip::ClipResult::KEPT, {} };
-    }
-}
+        int y0 = std::max(blockY, yMin);
+        int y1 = std::min(blockY + blockSize - 1, yMax);
+        for (int blockX = xMin & ~(blockSize - 1); blockX <= xMax; blockX += blockSize)
+        {
+            int x0 = std::max(blockX, xMin);
+            int x1 = std::min(blockX + blockSize - 1, xMax);
 
-Renderer::ClipPlane Renderer::nextClipPlane(ClipPlane plane)
-{
-    switch (plane)
-    {
-    case ClipPlane::NEAR:
-        return ClipPlane::LEFT;
-    case ClipPlane::LEFT:
-        return ClipPlane::RIGHT;
-    case ClipPlane::RIGHT:
-        return ClipPlane::BOTTOM;
-    case ClipPlane::BOTTOM:
-        return ClipPlane::TOP;
-    case ClipPlane::TOP:
-        return ClipPlane::NONE;
-    default:
-        return ClipPlane::NONE;
+            bool rejected = false;
+            bool partial[3];
+            int64_t origin[3];
+            for (int i = 0; i < 3; i++)
+            {
+                const Edge& edge = edges[i];
+                origin[i] = edge.at(blockX, blockY);
+                int64_t low = origin[i] + std::min(edge.a * blockSpan, (int64_t) 0) + std::min(edge.b * blockSpan, (int64_t) 0);
+                int64_t high = origin[i] + std::max(edge.a * blockSpan, (int64_t) 0) + std::max(edge.b * blockSpan, (int64_t) 0);
+                rejected |= high < 0;
+                partial[i] = low < 0;
+            }
+            if (rejected)
+                continue;
+
+            Vertex blockValue = gradients.at(blockX + 0.5, blockY + 0.5);
+            if (mipPerSpan)
+            {
+                // The center can lie outside the triangle, where 1 / z
+                // may have crossed zero; the last level is kept then
+                Vertex center = gradients.at((x0 + x1 + 1) * 0.5, (y0 + y1 + 1) * 0.5);
+                if (ortho || center.xyz.z > 0.0)
+                    mip = getMipLevel(texture, selectMipLevel(gradients.footprint(center, ortho), texture.getLevelCount()));
+            }
+
+            // Edges that fully contain the block are replaced by a constant
+            // non-negative value so they never reject a lane
+            Int4 edgeRow[3];
+            Int4 edgeStepX[3];
+            Int4 edgeStepY[3];
+            for (int i = 0; i < 3; i++)
+            {
+                if (partial[i])
+                {
+                    int a = (int) edges[i].a * subPixelScale;
+                    int b = (int) edges[i].b * subPixelScale;
+                    int start = (int) (origin[i] + edges[i].a * subPixelScale * ((x0 & ~1) - blockX) + edges[i].b * subPixelScale * ((y0 & ~1) - blockY));
+                    edgeRow[i] = Int4{ start } + Int4{ 0, a, b, a + b };
+                    edgeStepX[i] = Int4{ 2 * a };
+                    edgeStepY[i] = Int4{ 2 * b };
+                }
+                else
+                {
+                    edgeRow[i] = Int4{ 0 };
+                    edgeStepX[i] = Int4{ 0 };
+                    edgeStepY[i] = Int4{ 0 };
+                }
+            }
+
+            for (int y = y0 & ~1; y <= y1; y += 2)
+            {
+                int rowMask = (y >= y0 ? 0x3 : 0) | (y + 1 <= y1 ? 0xC : 0);
+                Int4 w0 = edgeRow[0];
+                Int4 w1 = edgeRow[1];
+                Int4 w2 = edgeRow[2];
+                for (int x = x0 & ~1; x <= x1; x += 2)
+                {
+                    int columnMask = (x >= x0 ? 0x5 : 0) | (x + 1 <= x1 ? 0xA : 0);
+                    int mask = ~movemask(w0 | w1 | w2) & rowMask & columnMask;
+                    if (mask)
+                        shadeQuad(x, y, mask, blockValue, blockX, blockY);
+                    w0 = w0 + edgeStepX[0];
+                    w1 = w1 + edgeStepX[1];
+                    w2 = w2 + edgeStepX[2];
+                }
+                edgeRow[0] = edgeRow[0] + edgeStepY[0];
+                edgeRow[1] = edgeRow[1] + edgeStepY[1];
+                edgeRow[2] = edgeRow[2] + edgeStepY[2];
+            }
+        }
     }
 }
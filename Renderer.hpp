@@ -2,96 +2,343 @@
 #define RENDERER_HPP
 
 #include "Raster.hpp"
+#include "Sampler.hpp"
 #include "Mesh.hpp"
+#include "MeshLod.hpp"
 #include "Camera.hpp"
 #include "Math.hpp"
 #include "LightSource.hpp"
+#include "ThreadPool.hpp"
+#include "DepthBuffer.hpp"
+#include "PostProcess.hpp"
+#include "Simd.hpp"
 
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <vector>
 #include <utility>
 #include <cmath>
+#include <cstdint>
 
 class Renderer
 {
 public:
-    Renderer(Raster* image);
+    // A thread count of 0 uses one thread per hardware core
+    Renderer(Raster* image, int threadCount = 0);
+
+    // Retargets rendering, e.g. to the next buffer of a swap chain. The new
+    // image must have the same size; depth is shared between targets
+    void setImage(Raster* image);
+    Raster* getImage() const;
 
     void clearColor(Color color);
     void clearDepth();
     void clearColorDepth(Color color);
 
+    // With fast clears, clearing only marks every tile of the binning grid
+    // as cleared. A tile is filled the first time a triangle touches it,
+    // by the thread that is about to rasterize it. resolveClears fills the
+    // tiles nothing touched and must run before the image or depth is read
+    // outside the renderer; postProcess calls it itself
+    void enableFastClears(bool enable);
+    void resolveClears();
+
     enum class Lighting
     {
         NONE, DIFFUSE
     };
 
+    enum class Rasterizer
+    {
+        SCANLINE, EDGE_FUNCTION
+    };
+
+    // Runs every enabled stage of the chain in one pass over the frame
+    void postProcess(const PostProcess& chain);
+    // A chain with fog only
     void fogPostProcess(double fogStart, double fogEnd, Color fogColor);
 
     void enableDepthTest(bool enable);
 
+    // Perspective-correct color and texture coordinates need a divide per
+    // pixel. The span modes divide only every 8 or 16 pixels of a scanline
+    // and interpolate linearly in between, falling back to per-pixel
+    // divides where depth changes too fast for that to stay accurate.
+    // Only the scanline rasterizer uses spans
+    enum class PerspectiveCorrection
+    {
+        PER_PIXEL, SPAN_8, SPAN_16
+    };
+    void setPerspectiveCorrection(PerspectiveCorrection perspectiveCorrection);
+    PerspectiveCorrection getPerspectiveCorrection() const;
+
+    // How textures with mipmaps (see Raster::generateMipmaps) pick a level.
+    // PER_TRIANGLE compares each triangle's texel area to its screen area.
+    // PER_SPAN works out the texel footprint of a pixel from the UV
+    // derivatives at the start of every span of a scanline, or of every
+    // 8x8 block with the edge function rasterizer, so large triangles
+    // receding into the distance change level along the way
+    enum class MipmapSelection
+    {
+        NONE, PER_TRIANGLE, PER_SPAN
+    };
+    void setMipmapSelection(MipmapSelection mipmapSelection);
+    MipmapSelection getMipmapSelection() const;
+
+    void setDepthFormat(DepthBuffer::Format format);
+    DepthBuffer::Format getDepthFormat() const;
+
+    void setRasterizer(Rasterizer rasterizer);
+    Rasterizer getRasterizer() const;
+
+    // Binning sorts clipped triangles into screen tiles, then rasterizes the
+    // tiles in parallel, each tile owned by one thread
+    void enableBinning(bool enable);
+    void setTileSize(int tileSize);
+    void setThreadCount(int threadCount);
+
+    // Untextured draws shade with the interpolated vertex colors only
+    void enableTexturing(bool enable);
+
+    // Filtering and addressing for textured draws. The default is nearest
+    // texels clamped to the edge
+    void setSampler(Sampler sampler);
+    Sampler getSampler() const;
+
+    // The render state the pixel pipeline is specialized on. Every
+    // combination is compiled into its own rasterizer, and renderMesh picks
+    // one per draw
+    struct PipelineState
+    {
+        bool orthographic;
+        bool depthTest;
+        bool textured;
+        bool alphaTest;
+    };
+    static const int pipelineVariantCount = 16;
+    static PipelineState getPipelineVariant(int variant);
+
+    // The variant renderMesh would choose for a draw
+    PipelineState getPipelineState(const Raster& texture, const Camera& camera) const;
+
     void renderMesh(Mesh& mesh, const Raster& texture, const Transform& transform, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting);
+
+    // Forces a pipeline variant, for benchmarking them individually. The
+    // projection must match the camera's
+    void renderMesh(Mesh& mesh, const Raster& texture, const Transform& transform, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting, PipelineState state);
+
+    // Draws the coarsest level of lods whose error would cover at most
+    // lodThreshold pixels at the point of the mesh's bounding sphere
+    // nearest the camera. The default is one pixel
+    void setLodThreshold(double lodThreshold);
+    double getLodThreshold() const;
+    int selectLod(const MeshLod& lods, const Transform& transform, const Camera& camera) const;
+    void renderMesh(MeshLod& lods, const Raster& texture, const Transform& transform, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting);
 private:
     Raster* image;
-    std::vector<double> depth;
+    DepthBuffer depth;
     bool depthTestEnabled;
+    bool texturingEnabled;
+    Sampler sampler;
+    double lodThreshold;
+    PerspectiveCorrection perspectiveCorrection;
+    MipmapSelection mipmapSelection;
+    Rasterizer rasterizer;
 
-    std::vector<Vertex> verticesCopy;
+    // 0 for per-pixel divides
+    static int getSpanLength(PerspectiveCorrection perspectiveCorrection);
+
+    // Largest error a linear span may have before falling back to per-pixel
+    // divides, in texels
+    static constexpr double maxSpanError = 0.25;
+
+    // Pixels per level choice in PER_SPAN mode when the scanline rasterizer
+    // divides per pixel and so has no spans of its own
+    static const int mipSpanLength = 16;
+
+    // A texture level, with the factors that take level 0 texel
+    // coordinates to it
+    struct MipLevel
+    {
+        const Raster* texture;
+        double scaleX, scaleY;
+    };
+    static MipLevel getMipLevel(const Raster& texture, int level)
+    {
+        const Raster& mipmap = texture.getLevel(level);
+        return MipLevel
+        {
+            &mipmap,
+            (double) mipmap.getWidth() / texture.getWidth(),
+            (double) mipmap.getHeight() / texture.getHeight()
+        };
+    }
+
+    // Nearest level for a footprint of sqrt(footprint) texels per pixel
+    static int selectMipLevel(double footprint, int levelCount)
+    {
+        if (!(footprint > 1.0))
+            return 0;
+        int level = (int) (0.5 * log2(footprint) + 0.5);
+        return std::min(level, levelCount - 1);
+    }
+
+    // Output of the vertex stage, in the same padded layout as MeshStreams:
+    // view-space positions and lit colors for the clipper, the same vertices
+    // already projected for triangles that need no clipping, and a clip code
+    // per vertex saying which planes it lies outside of
+    struct ViewStreams
+    {
+        void resize(int size);
+
+        std::vector<float> x, y, z;
+        std::vector<float> r, g, b;
+        std::vector<float> projX, projY, projZ;
+        std::vector<float> projR, projG, projB;
+        std::vector<float> projU, projV;
+        std::vector<uint8_t> clipCodes;
+    };
+    ViewStreams viewStreams;
     std::vector<bool> renderFace;
+    // Per meshlet of the current draw, and per block of four vertices,
+    // whether any visible meshlet uses it
+    std::vector<uint8_t> meshletVisible;
+    std::vector<uint8_t> activeBlocks;
+
+    // Clip code bits. The viewport bits are only set for vertices in front of
+    // the near plane, so a bit shared by all three vertices of a triangle
+    // always means it can be rejected
+    static const int clipNear = 1 << 0;
+    static const int clipFar = 1 << 1;
+    static const int clipLeft = 1 << 2;
+    static const int clipRight = 1 << 3;
+    static const int clipBottom = 1 << 4;
+    static const int clipTop = 1 << 5;
+    static const int clipGuardBand = 1 << 6;
+
+    void cullMeshlets(const MeshStreams& streams, const Matrix4& modelView, const Camera& camera);
+    void transformVertices(const MeshStreams& streams, const Raster& texture, const Matrix4& modelView, const Matrix4& view, const Camera& camera, const std::vector<LightSource>& lights, Lighting lighting);
+    void cullFaces(const MeshStreams& streams, const Matrix4& modelView, const Camera& camera);
+    void cullFaces(const MeshStreams& streams, const Matrix4& modelView, const Camera& camera, int start, int end);
+    Vertex getViewVertex(const MeshStreams& streams, int index) const
+    {
+        return Vertex
+        {
+            Vector3{ viewStreams.x[index], viewStreams.y[index], viewStreams.z[index] },
+            Vector3{ viewStreams.r[index], viewStreams.g[index], viewStreams.b[index] },
+            Vector2{ streams.u[index], streams.v[index] }
+        };
+    }
+    Vertex getProjectedVertex(int index) const
+    {
+        return Vertex
+        {
+            Vector3{ viewStreams.projX[index], viewStreams.projY[index], viewStreams.projZ[index] },
+            Vector3{ viewStreams.projR[index], viewStreams.projG[index], viewStreams.projB[index] },
+            Vector2{ viewStreams.projU[index], viewStreams.projV[index] }
+        };
+    }
+
+    struct Tile
+    {
+        int x0, y0, x1, y1;
+    };
+    struct ScreenTriangle
+    {
+        Vertex v0, v1, v2;
+        int mipLevel;
+    };
+    ThreadPool threadPool;
+    bool binningEnabled;
+    int tileSize;
+    int tilesX, tilesY;
+    std::vector<ScreenTriangle> binnedTriangles;
+    std::vector<std::vector<int>> tileBins;
 
+    void resizeBins();
+    // Pixel bounds of a tile
+    Tile getTile(int tileIndex) const;
+    // Tiles overlapped by a triangle's bounding box, in tile units
+    Tile getTileRange(const ScreenTriangle& triangle) const;
+    void binTriangle(const ScreenTriangle& triangle);
+    void flushBins(const Raster& texture);
+
+    // Per-tile bits for clears that haven't been carried out yet
+    static const int pendingColor = 1 << 0;
+    static const int pendingDepth = 1 << 1;
+    bool fastClearsEnabled;
+    bool clearsPending;
+    PackedColor pendingClearColor;
+    std::vector<uint8_t> pendingClears;
+
+    void markClears(int pending);
+    void resolveTile(int tileIndex);
+
+    // d is the interpolated depth: 1 / z in perspective, z in orthographic.
+    // Kernels only hand in pixels inside their tile, so there is no bounds
+    // check
+    template<bool DepthTest>
     bool testDepth(int index, double d)
     {
-        if (index < 0 || index >= depth.size())
-            return false;
-        if (d < depth[index] || !depthTestEnabled)
+        if (!DepthTest)
         {
-            depth[index] = d;
+            depth.write(index, d);
             return true;
         }
-        return false;
+        return depth.test(index, d);
     }
 
-    enum class ClipPlane
+    // Split form of testDepth for alpha-tested draws, where the depth write
+    // has to wait until the pixel is known to survive
+    template<bool DepthTest>
+    bool passesDepth(int index, double d) const
     {
-        NEAR,
-        LEFT,
-        RIGHT,
-        BOTTOM,
-        TOP,
-        NONE
-    };
-    static ClipPlane nextClipPlane(ClipPlane plane);
+        return !DepthTest || depth.passes(index, d);
+    }
 
-    struct EdgeClip
+    void writeDepth(int index, double d)
     {
-        enum class ClipResult
-        {
-            REMOVED, CLIPPED, KEPT
-        } result;
-        Vertex v;
+        depth.write(index, d);
+    }
+
+    // Triangles are only clipped against the viewport sides when they leave
+    // a guard band this many pixels wide; inside it they are scissored by
+    // the rasterizer. It keeps screen positions well inside the range the
+    // fixed-point setup handles
+    static const int guardBandPixels = 8192;
+    double guardBandX;
+    double guardBandY;
+
+    enum class ClipPlane
+    {
+        NEAR, FAR, LEFT, RIGHT, BOTTOM, TOP
     };
-    EdgeClip clipEdge(Vertex v0, Vertex v1, ClipPlane plane, const Camera& camera) const;
 
-    struct TriangleClip
+    // Enough for a triangle clipped by all six planes
+    static const int maxClipVertices = 9;
+
+    // Remembers which corner of the input triangle a clipped vertex is, if
+    // any, so that surviving corners reuse the vertex stage's projection
+    struct ClipVertex
     {
-        enum class ClipResult
-        {
-            REMOVED, CLIPPED_ONE, CLIPPED_TWO, KEPT
-        } result;
-        struct
-        {
-            Vertex v0, v1, v2;
-        } t0, t1;
+        Vertex vertex;
+        int corner;
     };
-    TriangleClip clipTriangle(Vertex v0, Vertex v1, Vertex v2, ClipPlane plane, const Camera& camera) const;
 
-    void doTriangle(Vertex v0, Vertex v1, Vertex v2, ClipPlane plane, const Raster& texture, const Camera& camera);
+    double planeDistance(const Vertex& v, ClipPlane plane, const Camera& camera) const;
+    int clipPolygon(const ClipVertex* polygon, int count, ClipVertex* clipped, ClipPlane plane, const Camera& camera) const;
+    void clipTriangle(const Vertex* view, const Vertex* projected, const Raster& texture, const Camera& camera);
 
     Vertex applyPerspective(Vertex v, const Raster& texture, const Camera& camera);
 
     struct LinearInterpolate
     {
         LinearInterpolate() {}
+        LinearInterpolate(Vertex value, Vertex incValue)
+            : value{ value }, incValue{ incValue }
+        {
+        }
         LinearInterpolate(Vertex v0, Vertex v1, double startT, double incT)
         {
             Vertex difference;
@@ -133,7 +380,158 @@ private:
         Vertex incValue;
     };
     
-    void rasterizeTriangle(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, const Camera& camera);
+    // Screen positions are snapped to 1 / 16 pixel before rasterization
+    static const int subPixelBits = 4;
+    static const int subPixelScale = 1 << subPixelBits;
+    static const int subPixelHalf = subPixelScale >> 1;
+
+    struct SubPixel
+    {
+        SubPixel() {}
+        SubPixel(const Vector3& p)
+            : x{ llround(p.x * subPixelScale) }, y{ llround(p.y * subPixelScale) }
+        {
+        }
+
+        int64_t x, y;
+    };
+
+    static int64_t floorDiv(int64_t numerator, int64_t denominator)
+    {
+        int64_t quotient = numerator / denominator;
+        if ((numerator % denominator != 0) && ((numerator < 0) != (denominator < 0)))
+            quotient--;
+        return quotient;
+    }
+
+    static int64_t ceilDiv(int64_t numerator, int64_t denominator)
+    {
+        return -floorDiv(-numerator, denominator);
+    }
+
+    // Walks an edge a -> b (a above b) one scanline at a time, producing the
+    // first pixel whose center lies on or right of the edge. Left edges start
+    // a span there and right edges end it there (exclusive), so pixels on a
+    // shared edge go to exactly one triangle
+    struct EdgeWalker
+    {
+        EdgeWalker() {}
+        EdgeWalker(SubPixel a, SubPixel b, int y)
+        {
+            int64_t dx = b.x - a.x;
+            int64_t dy = b.y - a.y;
+            denominator = dy * subPixelScale;
+            int64_t numerator = (a.x - subPixelHalf) * dy + (y * subPixelScale + subPixelHalf - a.y) * dx;
+            x = ceilDiv(numerator, denominator);
+            remainder = x * denominator - numerator;
+            int64_t step = dx * subPixelScale;
+            stepX = floorDiv(step, denominator);
+            stepRemainder = step - stepX * denominator;
+        }
+
+        void step()
+        {
+            x += stepX;
+            remainder -= stepRemainder;
+            if (remainder < 0)
+            {
+                x++;
+                remainder += denominator;
+            }
+        }
+
+        int64_t x;
+    private:
+        int64_t remainder;
+        int64_t denominator;
+        int64_t stepX;
+        int64_t stepRemainder;
+    };
+
+    // Screen-space plane equations for every interpolated attribute, set up
+    // once per triangle
+    struct Gradients
+    {
+        Gradients(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+
+        Vertex at(double x, double y) const
+        {
+            Vertex value = origin;
+            double offsetX = x - origin.xyz.x;
+            double offsetY = y - origin.xyz.y;
+            addScaled(value, dx, offsetX);
+            addScaled(value, dy, offsetY);
+            return value;
+        }
+
+        static void addScaled(Vertex& v, const Vertex& d, double s)
+        {
+            v.xyz.z += d.xyz.z * s;
+            v.rgb.x += d.rgb.x * s;
+            v.rgb.y += d.rgb.y * s;
+            v.rgb.z += d.rgb.z * s;
+            v.uv.x += d.uv.x * s;
+            v.uv.y += d.uv.y * s;
+        }
+
+        // Squared texel footprint of a pixel at an interpolated value: the
+        // longer of the distances covered in x and in y. Perspective
+        // values are divided by their 1 / z first
+        double footprint(const Vertex& value, bool ortho) const
+        {
+            double dudx = dx.uv.x;
+            double dvdx = dx.uv.y;
+            double dudy = dy.uv.x;
+            double dvdy = dy.uv.y;
+            if (!ortho)
+            {
+                double z = 1.0 / value.xyz.z;
+                double u = value.uv.x * z;
+                double v = value.uv.y * z;
+                dudx = (dudx - u * dx.xyz.z) * z;
+                dvdx = (dvdx - v * dx.xyz.z) * z;
+                dudy = (dudy - u * dy.xyz.z) * z;
+                dvdy = (dvdy - v * dy.xyz.z) * z;
+            }
+            return std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+        }
+
+        Vertex origin;
+        Vertex dx;
+        Vertex dy;
+    };
+
+    // PipelineState packed into the template argument of the kernels
+    static const int pipelineOrthographic = 1 << 0;
+    static const int pipelineDepthTest = 1 << 1;
+    static const int pipelineTextured = 1 << 2;
+    static const int pipelineAlphaTest = 1 << 3;
+
+    using TriangleRasterizer = void (Renderer::*)(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, Tile tile);
+    TriangleRasterizer activeRasterizer;
+    // The pipeline bits of the draw in progress
+    int activeState;
+
+    template<int... States>
+    static std::array<TriangleRasterizer, sizeof...(States)> scanlineVariants(std::integer_sequence<int, States...>)
+    {
+        return { &Renderer::rasterizeScanline<States>... };
+    }
+    template<int... States>
+    static std::array<TriangleRasterizer, sizeof...(States)> edgeFunctionVariants(std::integer_sequence<int, States...>)
+    {
+        return { &Renderer::rasterizeEdgeFunction<States>... };
+    }
+
+    void submitTriangle(Vertex v0, Vertex v1, Vertex v2, const Raster& texture);
+    void rasterizeTriangle(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, Tile tile)
+    {
+        (this->*activeRasterizer)(v0, v1, v2, texture, tile);
+    }
+    template<int State>
+    void rasterizeScanline(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, Tile tile);
+    template<int State>
+    void rasterizeEdgeFunction(Vertex v0, Vertex v1, Vertex v2, const Raster& texture, Tile tile);
 };
 
 #endif
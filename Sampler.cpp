@@ -0,0 +1,26 @@
+#include "Sampler.hpp"
+
+Sampler::Sampler(Filter filter, Address address)
+    : filter{ filter }, address{ address }
+{
+}
+
+void Sampler::setFilter(Filter filter)
+{
+    this->filter = filter;
+}
+
+Sampler::Filter Sampler::getFilter() const
+{
+    return filter;
+}
+
+void Sampler::setAddress(Address address)
+{
+    this->address = address;
+}
+
+Sampler::Address Sampler::getAddress() const
+{
+    return address;
+}
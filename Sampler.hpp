@@ -0,0 +1,180 @@
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include "Raster.hpp"
+#include "Simd.hpp"
+
+// Texture lookups for the pixel pipeline. Coordinates are in texels of the
+// raster being sampled; the address mode brings them back inside it and the
+// filter decides how many texels are read
+class Sampler
+{
+public:
+    enum class Filter
+    {
+        NEAREST, BILINEAR
+    };
+
+    // CLAMP stretches the edge texels outwards, REPEAT tiles the texture
+    // and MIRROR tiles it with every other copy flipped. Power-of-two sizes
+    // wrap with masks, other sizes need a divide per coordinate
+    enum class Address
+    {
+        CLAMP, REPEAT, MIRROR
+    };
+
+    Sampler(Filter filter = Filter::NEAREST, Address address = Address::CLAMP);
+
+    void setFilter(Filter filter);
+    Filter getFilter() const;
+    void setAddress(Address address);
+    Address getAddress() const;
+
+    // Four pixels at a time, one per lane
+    Int4 sample(const Raster& texture, Float4 u, Float4 v) const
+    {
+        if (filter == Filter::NEAREST)
+            return fetch(texture, floorToInt(u), floorToInt(v));
+
+        // Texel centers sit at half coordinates. The fractions become 0 - 256
+        // weights for blend, horizontally then vertically
+        Float4 half{ 0.5f };
+        Float4 weightScale{ 256.0f };
+        u = u - half;
+        v = v - half;
+        Int4 x = floorToInt(u);
+        Int4 y = floorToInt(v);
+        Int4 weightX = toInt((u - toFloat(x)) * weightScale);
+        Int4 weightY = toInt((v - toFloat(y)) * weightScale);
+        Int4 one{ 1 };
+        int x0[4];
+        int x1[4];
+        int y0[4];
+        int y1[4];
+        wrap(x, texture.getWidth()).store(x0);
+        wrap(x + one, texture.getWidth()).store(x1);
+        wrap(y, texture.getHeight()).store(y0);
+        wrap(y + one, texture.getHeight()).store(y1);
+        int topLeft[4];
+        int topRight[4];
+        int bottomLeft[4];
+        int bottomRight[4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            topLeft[lane] = (int) texture.getTexel(x0[lane], y0[lane]);
+            topRight[lane] = (int) texture.getTexel(x1[lane], y0[lane]);
+            bottomLeft[lane] = (int) texture.getTexel(x0[lane], y1[lane]);
+            bottomRight[lane] = (int) texture.getTexel(x1[lane], y1[lane]);
+        }
+        Int4 top = blend(Int4::load(topLeft), Int4::load(topRight), weightX);
+        Int4 bottom = blend(Int4::load(bottomLeft), Int4::load(bottomRight), weightX);
+        return blend(top, bottom, weightY);
+    }
+
+    // One pixel, for the scanline rasterizer
+    uint32_t sample(const Raster& texture, double u, double v) const
+    {
+        int width = texture.getWidth();
+        int height = texture.getHeight();
+        if (filter == Filter::NEAREST)
+            return texture.getTexel(wrap(floorToIntScalar(u), width), wrap(floorToIntScalar(v), height));
+
+        u -= 0.5;
+        v -= 0.5;
+        int x = floorToIntScalar(u);
+        int y = floorToIntScalar(v);
+        int x0 = wrap(x, width);
+        int x1 = wrap(x + 1, width);
+        int y0 = wrap(y, height);
+        int y1 = wrap(y + 1, height);
+        int weightX = (int) ((u - x) * 256.0);
+        int weightY = (int) ((v - y) * 256.0);
+
+        // Both rows share one horizontal blend in lanes 0 and 1
+        Int4 left{ (int) texture.getTexel(x0, y0), (int) texture.getTexel(x0, y1), 0, 0 };
+        Int4 right{ (int) texture.getTexel(x1, y0), (int) texture.getTexel(x1, y1), 0, 0 };
+        int rows[4];
+        blend(left, right, Int4{ weightX }).store(rows);
+        int texel[4];
+        blend(Int4{ rows[0] }, Int4{ rows[1] }, Int4{ weightY }).store(texel);
+        return (uint32_t) texel[0];
+    }
+private:
+    Filter filter;
+    Address address;
+
+    static int floorToIntScalar(double a)
+    {
+        int truncated = (int) a;
+        return truncated - (a < truncated ? 1 : 0);
+    }
+
+    Int4 fetch(const Raster& texture, Int4 x, Int4 y) const
+    {
+        int xs[4];
+        int ys[4];
+        int texels[4];
+        wrap(x, texture.getWidth()).store(xs);
+        wrap(y, texture.getHeight()).store(ys);
+        for (int lane = 0; lane < 4; lane++)
+            texels[lane] = (int) texture.getTexel(xs[lane], ys[lane]);
+        return Int4::load(texels);
+    }
+
+    Int4 wrap(Int4 coordinate, int size) const
+    {
+        bool powerOfTwo = (size & (size - 1)) == 0;
+        switch (address)
+        {
+        case Address::CLAMP:
+            return min(max(coordinate, Int4{ 0 }), Int4{ size - 1 });
+        case Address::REPEAT:
+            if (powerOfTwo)
+                return coordinate & Int4{ size - 1 };
+            break;
+        case Address::MIRROR:
+            // Odd copies have the size bit set; inverting every bit below it
+            // counts them backwards
+            if (powerOfTwo)
+            {
+                Int4 flip = (coordinate & Int4{ size }) > Int4{ 0 };
+                return (coordinate ^ flip) & Int4{ size - 1 };
+            }
+            break;
+        }
+
+        int lanes[4];
+        coordinate.store(lanes);
+        for (int lane = 0; lane < 4; lane++)
+            lanes[lane] = wrap(lanes[lane], size);
+        return Int4::load(lanes);
+    }
+
+    int wrap(int coordinate, int size) const
+    {
+        switch (address)
+        {
+        case Address::REPEAT:
+        {
+            if ((size & (size - 1)) == 0)
+                return coordinate & (size - 1);
+            int wrapped = coordinate % size;
+            return wrapped < 0 ? wrapped + size : wrapped;
+        }
+        case Address::MIRROR:
+        {
+            if ((size & (size - 1)) == 0)
+                return ((coordinate & size) ? ~coordinate : coordinate) & (size - 1);
+            int period = 2 * size;
+            int wrapped = coordinate % period;
+            if (wrapped < 0)
+                wrapped += period;
+            return wrapped < size ? wrapped : period - 1 - wrapped;
+        }
+        default:
+            return coordinate < 0 ? 0 : coordinate >= size ? size - 1 : coordinate;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include "ShmRingSink.hpp"
+
+#include <chrono>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring indices must be lock-free to be shared between processes");
+
+ShmRingSink::ShmRingSink(std::string name, int width, int height, int slotCount, Backpressure backpressure)
+    : name{ name }, backpressure{ backpressure }, droppedFrames{ 0 }, mapping{ nullptr }, mappingSize{ 0 }, header{ nullptr }
+{
+    // Slots start on page boundaries so a consumer can map or hand them on
+    // individually
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    auto roundUp = [pageSize](size_t bytes) { return (bytes + pageSize - 1) / pageSize * pageSize; };
+    size_t dataOffset = roundUp(sizeof(ShmRingHeader));
+    size_t slotStride = roundUp((size_t) width * height * 4);
+    mappingSize = dataOffset + slotStride * slotCount;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0)
+        return;
+    if (ftruncate(fd, mappingSize) != 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        return;
+    }
+    mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        shm_unlink(name.c_str());
+        return;
+    }
+
+    header = new (mapping) ShmRingHeader{};
+    header->width = width;
+    header->height = height;
+    header->slotCount = slotCount;
+    header->slotStride = slotStride;
+    header->dataOffset = dataOffset;
+    header->writeIndex.store(0);
+    header->readIndex.store(0);
+    header->closed.store(0);
+    uint8_t* data = static_cast<uint8_t*>(mapping) + dataOffset;
+    for (int i = 0; i < slotCount; i++)
+        slots.push_back(std::make_unique<Raster>(width, height, reinterpret_cast<uint32_t*>(data + i * slotStride)));
+    // Consumers check the magic last, once everything else is in place
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ShmRingHeader::magicValue;
+}
+
+ShmRingSink::~ShmRingSink()
+{
+    closeRing();
+}
+
+Raster* ShmRingSink::acquireFrame()
+{
+    if (mapping == nullptr)
+        return nullptr;
+
+    if (isFull())
+    {
+        if (backpressure == Backpressure::DROP)
+        {
+            droppedFrames++;
+            return nullptr;
+        }
+        // The consumer is another process, so there is nothing to wait on
+        // but its index. Polling at this rate costs nothing next to a frame.
+        // The timeout restarts whenever the consumer makes progress
+        uint64_t readIndex = header->readIndex.load(std::memory_order_relaxed);
+        auto deadline = std::chrono::steady_clock::now() + consumerTimeout;
+        while (isFull())
+        {
+            uint64_t newReadIndex = header->readIndex.load(std::memory_order_relaxed);
+            if (newReadIndex != readIndex)
+            {
+                readIndex = newReadIndex;
+                deadline = std::chrono::steady_clock::now() + consumerTimeout;
+            }
+            else if (std::chrono::steady_clock::now() >= deadline)
+            {
+                closeRing();
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds{ 100 });
+        }
+    }
+    uint64_t writeIndex = header->writeIndex.load(std::memory_order_relaxed);
+    return slots[writeIndex % slots.size()].get();
+}
+
+bool ShmRingSink::submitFrame(Raster* frame)
+{
+    if (mapping == nullptr)
+        return false;
+    uint64_t writeIndex = header->writeIndex.load(std::memory_order_relaxed);
+    if (frame != slots[writeIndex % slots.size()].get())
+        return false;
+    // Release ordering makes the pixels visible before the index that
+    // publishes them
+    header->writeIndex.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+bool ShmRingSink::isOpen() const
+{
+    return mapping != nullptr;
+}
+
+int ShmRingSink::getDroppedFrames() const
+{
+    return droppedFrames;
+}
+
+bool ShmRingSink::isFull() const
+{
+    uint64_t writeIndex = header->writeIndex.load(std::memory_order_relaxed);
+    uint64_t readIndex = header->readIndex.load(std::memory_order_acquire);
+    return writeIndex - readIndex >= slots.size();
+}
+
+void ShmRingSink::closeRing()
+{
+    if (mapping == nullptr)
+        return;
+    header->closed.store(1, std::memory_order_release);
+    slots.clear();
+    munmap(mapping, mappingSize);
+    shm_unlink(name.c_str());
+    mapping = nullptr;
+    header = nullptr;
+}
@@ -0,0 +1,74 @@
+#ifndef SHMRINGSINK_HPP
+#define SHMRINGSINK_HPP
+
+#include "FrameSink.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The start of the shared-memory object. Slot i of the ring starts
+// dataOffset + i * slotStride bytes in and holds one row-major RGBA frame.
+// Frame n lives in slot n % slotCount. The producer fills slot
+// writeIndex % slotCount and then increments writeIndex; the consumer
+// reads slot readIndex % slotCount while readIndex < writeIndex and then
+// increments readIndex. The producer waits or drops while the ring is
+// full, that is while writeIndex - readIndex == slotCount
+struct ShmRingHeader
+{
+    static const uint32_t magicValue = 0x52534652; // "RFSR"
+
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t slotCount;
+    uint64_t slotStride;
+    uint64_t dataOffset;
+
+    // Each index on its own cache line, so the two sides don't contend
+    alignas(64) std::atomic<uint64_t> writeIndex;
+    alignas(64) std::atomic<uint64_t> readIndex;
+    // Set by the producer once no more frames will come
+    alignas(64) std::atomic<uint32_t> closed;
+};
+
+// A FrameSink backed by a POSIX shared-memory ring of frame slots. Frames
+// are drawn directly into the slots, so publishing one is a single index
+// store. The object is created, or replaced, under name (like "/frames")
+// and unlinked again on destruction. In BLOCK mode a consumer that stops
+// reading for consumerTimeout is taken to be gone, and the sink closes
+class ShmRingSink : public FrameSink
+{
+public:
+    ShmRingSink(std::string name, int width, int height, int slotCount, Backpressure backpressure);
+    ~ShmRingSink();
+
+    ShmRingSink(const ShmRingSink&) = delete;
+    ShmRingSink& operator=(const ShmRingSink&) = delete;
+
+    Raster* acquireFrame() override;
+    bool submitFrame(Raster* frame) override;
+
+    bool isOpen() const override;
+    int getDroppedFrames() const override;
+private:
+    static constexpr std::chrono::milliseconds consumerTimeout{ 5000 };
+
+    std::string name;
+    Backpressure backpressure;
+    int droppedFrames;
+
+    void* mapping;
+    size_t mappingSize;
+    ShmRingHeader* header;
+    std::vector<std::unique_ptr<Raster>> slots;
+
+    bool isFull() const;
+    // Marks the ring closed for the consumer and unmaps and unlinks it
+    void closeRing();
+};
+
+#endif
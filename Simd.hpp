@@ -0,0 +1,267 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+#include <cstdint>
+
+// Four-lane float and int vectors. They map onto SSE2 registers when the
+// target has them and fall back to plain arrays otherwise, so code written
+// against them compiles everywhere.
+
+struct Float4
+{
+#ifdef SIMD_SSE2
+    Float4() : v{ _mm_setzero_ps() } {}
+    Float4(float s) : v{ _mm_set1_ps(s) } {}
+    Float4(float a, float b, float c, float d) : v{ _mm_setr_ps(a, b, c, d) } {}
+    Float4(__m128 v) : v{ v } {}
+
+    static Float4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    __m128 v;
+#else
+    Float4() : Float4{ 0.0f } {}
+    Float4(float s) : Float4{ s, s, s, s } {}
+    Float4(float a, float b, float c, float d) : v{ a, b, c, d } {}
+
+    static Float4 load(const float* p) { return Float4{ p[0], p[1], p[2], p[3] }; }
+    void store(float* p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+
+    float v[4];
+#endif
+};
+
+struct Int4
+{
+#ifdef SIMD_SSE2
+    Int4() : v{ _mm_setzero_si128() } {}
+    Int4(int s) : v{ _mm_set1_epi32(s) } {}
+    Int4(int a, int b, int c, int d) : v{ _mm_setr_epi32(a, b, c, d) } {}
+    Int4(__m128i v) : v{ v } {}
+
+    static Int4 load(const int* p) { return _mm_loadu_si128((const __m128i*) p); }
+    void store(int* p) const { _mm_storeu_si128((__m128i*) p, v); }
+
+    __m128i v;
+#else
+    Int4() : Int4{ 0 } {}
+    Int4(int s) : Int4{ s, s, s, s } {}
+    Int4(int a, int b, int c, int d) : v{ a, b, c, d } {}
+
+    static Int4 load(const int* p) { return Int4{ p[0], p[1], p[2], p[3] }; }
+    void store(int* p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+
+    int v[4];
+#endif
+};
+
+#ifdef SIMD_SSE2
+
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+
+// Comparisons return all-ones lanes where true; movemask packs the lane
+// sign bits into the low four bits of an int
+inline Float4 operator>=(Float4 a, Float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Float4 operator>(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator&(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+inline int movemask(Float4 a) { return _mm_movemask_ps(a.v); }
+
+inline Int4 operator+(Int4 a, Int4 b) { return _mm_add_epi32(a.v, b.v); }
+inline Int4 operator-(Int4 a, Int4 b) { return _mm_sub_epi32(a.v, b.v); }
+inline Int4 operator>(Int4 a, Int4 b) { return _mm_cmpgt_epi32(a.v, b.v); }
+inline Int4 operator<(Int4 a, Int4 b) { return _mm_cmplt_epi32(a.v, b.v); }
+inline Int4 operator&(Int4 a, Int4 b) { return _mm_and_si128(a.v, b.v); }
+inline Int4 operator|(Int4 a, Int4 b) { return _mm_or_si128(a.v, b.v); }
+inline Int4 operator^(Int4 a, Int4 b) { return _mm_xor_si128(a.v, b.v); }
+inline int movemask(Int4 a) { return _mm_movemask_ps(_mm_castsi128_ps(a.v)); }
+
+// Lanes of a where mask is all ones, of b where it is zero
+inline Int4 select(Int4 mask, Int4 a, Int4 b) { return _mm_or_si128(_mm_and_si128(mask.v, a.v), _mm_andnot_si128(mask.v, b.v)); }
+inline Int4 min(Int4 a, Int4 b) { return select(a < b, a, b); }
+inline Int4 max(Int4 a, Int4 b) { return select(a > b, a, b); }
+
+inline Float4 toFloat(Int4 a) { return _mm_cvtepi32_ps(a.v); }
+inline Int4 toInt(Float4 a) { return _mm_cvttps_epi32(a.v); }
+
+// Rounds towards negative infinity, where toInt truncates
+inline Int4 floorToInt(Float4 a)
+{
+    __m128i truncated = _mm_cvttps_epi32(a.v);
+    __m128i above = _mm_castps_si128(_mm_cmplt_ps(a.v, _mm_cvtepi32_ps(truncated)));
+    return _mm_add_epi32(truncated, above);
+}
+
+// Packed RGBA8 pixels, one per lane with red in the lowest byte. modulate
+// scales red, green and blue by per-pixel factors rounded down to 8.8 fixed
+// point, saturating at 255, and leaves alpha alone
+inline Int4 modulate(Int4 pixels, Float4 r, Float4 g, Float4 b)
+{
+    Float4 scale{ 256.0f };
+    Float4 low{ 0.0f };
+    Float4 high{ 65535.0f };
+    __m128i fr = _mm_cvttps_epi32(min(max(r * scale, low), high).v);
+    __m128i fg = _mm_cvttps_epi32(min(max(g * scale, low), high).v);
+    __m128i fb = _mm_cvttps_epi32(min(max(b * scale, low), high).v);
+
+    // Interleave into 16-bit factors in channel order, alpha scaled by 1.0
+    __m128i rg = _mm_or_si128(fr, _mm_slli_epi32(fg, 16));
+    __m128i ba = _mm_or_si128(fb, _mm_set1_epi32(256 << 16));
+    __m128i factors01 = _mm_unpacklo_epi32(rg, ba);
+    __m128i factors23 = _mm_unpackhi_epi32(rg, ba);
+
+    // (channel << 8) * factor >> 16 is channel * factor >> 8
+    __m128i zero = _mm_setzero_si128();
+    __m128i pixels01 = _mm_slli_epi16(_mm_unpacklo_epi8(pixels.v, zero), 8);
+    __m128i pixels23 = _mm_slli_epi16(_mm_unpackhi_epi8(pixels.v, zero), 8);
+    pixels01 = _mm_mulhi_epu16(pixels01, factors01);
+    pixels23 = _mm_mulhi_epu16(pixels23, factors23);
+
+    // packus saturates signed words, so products of 32768 and up would
+    // come out as 0. Clamp them to 255 first, which SSE2 can only do
+    // unsigned as x - max(x - 255, 0)
+    __m128i channelMax = _mm_set1_epi16(255);
+    pixels01 = _mm_sub_epi16(pixels01, _mm_subs_epu16(pixels01, channelMax));
+    pixels23 = _mm_sub_epi16(pixels23, _mm_subs_epu16(pixels23, channelMax));
+    return _mm_packus_epi16(pixels01, pixels23);
+}
+
+// Single-pixel form for scanline code; only the first lane does work
+inline uint32_t modulate(uint32_t pixel, float r, float g, float b)
+{
+    Int4 pixels{ _mm_cvtsi32_si128((int) pixel) };
+    return (uint32_t) _mm_cvtsi128_si32(modulate(pixels, Float4{ r }, Float4{ g }, Float4{ b }).v);
+}
+
+// Per-pixel linear blend from -> to by amount / 256, amount in 0 - 256,
+// applied to all four channels. The weights sum to 256 so nothing overflows
+inline Int4 blend(Int4 from, Int4 to, Int4 amount)
+{
+    __m128i weight = _mm_or_si128(amount.v, _mm_slli_epi32(amount.v, 16));
+    __m128i weight01 = _mm_unpacklo_epi32(weight, weight);
+    __m128i weight23 = _mm_unpackhi_epi32(weight, weight);
+    __m128i full = _mm_set1_epi16(256);
+    __m128i zero = _mm_setzero_si128();
+
+    auto blendHalf = [&](__m128i a, __m128i b, __m128i w)
+    {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(full, w)), _mm_mullo_epi16(b, w));
+        return _mm_srli_epi16(sum, 8);
+    };
+    __m128i result01 = blendHalf(_mm_unpacklo_epi8(from.v, zero), _mm_unpacklo_epi8(to.v, zero), weight01);
+    __m128i result23 = blendHalf(_mm_unpackhi_epi8(from.v, zero), _mm_unpackhi_epi8(to.v, zero), weight23);
+    return _mm_packus_epi16(result01, result23);
+}
+
+#else
+
+inline Float4 operator+(Float4 a, Float4 b) { return Float4{ a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] }; }
+inline Float4 operator-(Float4 a, Float4 b) { return Float4{ a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] }; }
+inline Float4 operator*(Float4 a, Float4 b) { return Float4{ a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] }; }
+inline Float4 operator/(Float4 a, Float4 b) { return Float4{ a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3] }; }
+inline Float4 min(Float4 a, Float4 b) { return Float4{ fminf(a.v[0], b.v[0]), fminf(a.v[1], b.v[1]), fminf(a.v[2], b.v[2]), fminf(a.v[3], b.v[3]) }; }
+inline Float4 max(Float4 a, Float4 b) { return Float4{ fmaxf(a.v[0], b.v[0]), fmaxf(a.v[1], b.v[1]), fmaxf(a.v[2], b.v[2]), fmaxf(a.v[3], b.v[3]) }; }
+inline Float4 sqrt(Float4 a) { return Float4{ sqrtf(a.v[0]), sqrtf(a.v[1]), sqrtf(a.v[2]), sqrtf(a.v[3]) }; }
+
+// Comparison results are stored as -1.0f / 0.0f so that movemask can read
+// the sign bit the same way the SSE version does
+inline Float4 operator>=(Float4 a, Float4 b) { return Float4{ a.v[0] >= b.v[0] ? -1.0f : 0.0f, a.v[1] >= b.v[1] ? -1.0f : 0.0f, a.v[2] >= b.v[2] ? -1.0f : 0.0f, a.v[3] >= b.v[3] ? -1.0f : 0.0f }; }
+inline Float4 operator>(Float4 a, Float4 b) { return Float4{ a.v[0] > b.v[0] ? -1.0f : 0.0f, a.v[1] > b.v[1] ? -1.0f : 0.0f, a.v[2] > b.v[2] ? -1.0f : 0.0f, a.v[3] > b.v[3] ? -1.0f : 0.0f }; }
+inline Float4 operator<(Float4 a, Float4 b) { return b > a; }
+inline Float4 operator&(Float4 a, Float4 b) { return Float4{ a.v[0] < 0.0f && b.v[0] < 0.0f ? -1.0f : 0.0f, a.v[1] < 0.0f && b.v[1] < 0.0f ? -1.0f : 0.0f, a.v[2] < 0.0f && b.v[2] < 0.0f ? -1.0f : 0.0f, a.v[3] < 0.0f && b.v[3] < 0.0f ? -1.0f : 0.0f }; }
+inline int movemask(Float4 a) { return (a.v[0] < 0.0f) | (a.v[1] < 0.0f) << 1 | (a.v[2] < 0.0f) << 2 | (a.v[3] < 0.0f) << 3; }
+
+inline Int4 operator+(Int4 a, Int4 b) { return Int4{ a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] }; }
+inline Int4 operator-(Int4 a, Int4 b) { return Int4{ a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] }; }
+inline Int4 operator>(Int4 a, Int4 b) { return Int4{ a.v[0] > b.v[0] ? -1 : 0, a.v[1] > b.v[1] ? -1 : 0, a.v[2] > b.v[2] ? -1 : 0, a.v[3] > b.v[3] ? -1 : 0 }; }
+inline Int4 operator<(Int4 a, Int4 b) { return b > a; }
+inline Int4 operator&(Int4 a, Int4 b) { return Int4{ a.v[0] & b.v[0], a.v[1] & b.v[1], a.v[2] & b.v[2], a.v[3] & b.v[3] }; }
+inline Int4 operator|(Int4 a, Int4 b) { return Int4{ a.v[0] | b.v[0], a.v[1] | b.v[1], a.v[2] | b.v[2], a.v[3] | b.v[3] }; }
+inline Int4 operator^(Int4 a, Int4 b) { return Int4{ a.v[0] ^ b.v[0], a.v[1] ^ b.v[1], a.v[2] ^ b.v[2], a.v[3] ^ b.v[3] }; }
+inline int movemask(Int4 a) { return (a.v[0] < 0) | (a.v[1] < 0) << 1 | (a.v[2] < 0) << 2 | (a.v[3] < 0) << 3; }
+
+inline Int4 select(Int4 mask, Int4 a, Int4 b) { return (mask & a) | (Int4{ ~mask.v[0], ~mask.v[1], ~mask.v[2], ~mask.v[3] } & b); }
+inline Int4 min(Int4 a, Int4 b) { return select(a < b, a, b); }
+inline Int4 max(Int4 a, Int4 b) { return select(a > b, a, b); }
+
+inline Float4 toFloat(Int4 a) { return Float4{ (float) a.v[0], (float) a.v[1], (float) a.v[2], (float) a.v[3] }; }
+inline Int4 toInt(Float4 a) { return Int4{ (int) a.v[0], (int) a.v[1], (int) a.v[2], (int) a.v[3] }; }
+
+inline Int4 floorToInt(Float4 a)
+{
+    Int4 result;
+    for (int i = 0; i < 4; i++)
+    {
+        int truncated = (int) a.v[i];
+        result.v[i] = truncated - (a.v[i] < (float) truncated ? 1 : 0);
+    }
+    return result;
+}
+
+inline Int4 modulate(Int4 pixels, Float4 r, Float4 g, Float4 b)
+{
+    Int4 result;
+    for (int i = 0; i < 4; i++)
+    {
+        unsigned int pixel = pixels.v[i];
+        float factors[3] = { r.v[i], g.v[i], b.v[i] };
+        unsigned int modulated = pixel & 0xFF000000;
+        for (int channel = 0; channel < 3; channel++)
+        {
+            unsigned int fixed = (unsigned int) fminf(fmaxf(factors[channel] * 256.0f, 0.0f), 65535.0f);
+            unsigned int value = ((pixel >> (channel * 8) & 0xFF) * fixed) >> 8;
+            modulated |= (value > 255 ? 255 : value) << (channel * 8);
+        }
+        result.v[i] = (int) modulated;
+    }
+    return result;
+}
+
+inline uint32_t modulate(uint32_t pixel, float r, float g, float b)
+{
+    return (uint32_t) modulate(Int4{ (int) pixel }, Float4{ r }, Float4{ g }, Float4{ b }).v[0];
+}
+
+inline Int4 blend(Int4 from, Int4 to, Int4 amount)
+{
+    Int4 result;
+    for (int i = 0; i < 4; i++)
+    {
+        unsigned int blended = 0;
+        for (int channel = 0; channel < 4; channel++)
+        {
+            unsigned int a = (unsigned int) from.v[i] >> (channel * 8) & 0xFF;
+            unsigned int b = (unsigned int) to.v[i] >> (channel * 8) & 0xFF;
+            blended |= ((a * (256 - amount.v[i]) + b * amount.v[i]) >> 8) << (channel * 8);
+        }
+        result.v[i] = (int) blended;
+    }
+    return result;
+}
+
+#endif
+
+// Asks for the cache line holding address ahead of a load that would
+// otherwise miss, such as a hash table probe
+inline void prefetch(const void* address)
+{
+#ifdef SIMD_SSE2
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+    (void) address;
+#endif
+}
+
+#endif
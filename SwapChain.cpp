@@ -0,0 +1,74 @@
+#include "SwapChain.hpp"
+
+SwapChain::SwapChain(int width, int height, int bufferCount)
+    : pendingFrame{ nullptr }, closed{ false }
+{
+    for (int i = 0; i < bufferCount; i++)
+    {
+        buffers.push_back(std::make_unique<Raster>(width, height));
+        freeBuffers.push_back(buffers.back().get());
+    }
+}
+
+int SwapChain::getBufferCount() const
+{
+    return buffers.size();
+}
+
+Raster* SwapChain::acquire()
+{
+    std::unique_lock<std::mutex> lock{ mutex };
+    if (freeBuffers.empty() && pendingFrame != nullptr)
+    {
+        // The presenter is still busy with an older frame, so the one
+        // waiting for it is dropped and drawn over
+        Raster* buffer = pendingFrame;
+        pendingFrame = nullptr;
+        return buffer;
+    }
+    freeCondition.wait(lock, [this] { return !freeBuffers.empty(); });
+    Raster* buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+    return buffer;
+}
+
+void SwapChain::submit(Raster* buffer)
+{
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        if (pendingFrame != nullptr)
+            freeBuffers.push_back(pendingFrame);
+        pendingFrame = buffer;
+    }
+    frameCondition.notify_one();
+    freeCondition.notify_one();
+}
+
+Raster* SwapChain::takeFrame()
+{
+    std::unique_lock<std::mutex> lock{ mutex };
+    frameCondition.wait(lock, [this] { return pendingFrame != nullptr || closed; });
+    if (closed)
+        return nullptr;
+    Raster* frame = pendingFrame;
+    pendingFrame = nullptr;
+    return frame;
+}
+
+void SwapChain::release(Raster* buffer)
+{
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        freeBuffers.push_back(buffer);
+    }
+    freeCondition.notify_one();
+}
+
+void SwapChain::close()
+{
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        closed = true;
+    }
+    frameCondition.notify_all();
+}
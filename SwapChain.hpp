@@ -0,0 +1,49 @@
+#ifndef SWAPCHAIN_HPP
+#define SWAPCHAIN_HPP
+
+#include "Raster.hpp"
+
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+
+// A set of equally sized render targets passed between a rendering thread
+// and a presenting thread. The renderer acquires a free buffer, draws into
+// it and submits it; the presenter takes the newest submitted frame, shows
+// it and releases it. A submitted frame the presenter hasn't taken yet is
+// replaced by the next one, so rendering never waits for presentation as
+// long as there are at least two buffers
+class SwapChain
+{
+public:
+    SwapChain(int width, int height, int bufferCount = 3);
+
+    SwapChain(const SwapChain&) = delete;
+    SwapChain& operator=(const SwapChain&) = delete;
+
+    int getBufferCount() const;
+
+    // Rendering side
+    Raster* acquire();
+    void submit(Raster* buffer);
+
+    // Presenting side. Blocks until a frame is submitted, returns nullptr
+    // once the chain is closed
+    Raster* takeFrame();
+    void release(Raster* buffer);
+
+    // Wakes the presenter for good
+    void close();
+private:
+    std::vector<std::unique_ptr<Raster>> buffers;
+    std::vector<Raster*> freeBuffers;
+    Raster* pendingFrame;
+
+    std::mutex mutex;
+    std::condition_variable frameCondition;
+    std::condition_variable freeCondition;
+    bool closed;
+};
+
+#endif
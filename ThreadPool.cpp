@@ -0,0 +1,101 @@
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(int threadCount)
+    : job{ nullptr }, jobCount{ 0 }, nextJob{ 0 }, busyWorkers{ 0 }, generation{ 0 }, stopping{ false }
+{
+    startWorkers(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopWorkers();
+}
+
+void ThreadPool::setThreadCount(int threadCount)
+{
+    stopWorkers();
+    startWorkers(threadCount);
+}
+
+int ThreadPool::getThreadCount() const
+{
+    return workers.size() + 1;
+}
+
+void ThreadPool::run(int jobCount, const std::function<void(int)>& job)
+{
+    if (workers.empty() || jobCount <= 1)
+    {
+        for (int i = 0; i < jobCount; i++)
+            job(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        this->job = &job;
+        this->jobCount = jobCount;
+        nextJob = 0;
+        busyWorkers = workers.size();
+        generation++;
+    }
+    startCondition.notify_all();
+
+    takeJobs();
+
+    std::unique_lock<std::mutex> lock{ mutex };
+    doneCondition.wait(lock, [this] { return busyWorkers == 0; });
+    this->job = nullptr;
+}
+
+void ThreadPool::startWorkers(int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount <= 0)
+        threadCount = 1;
+
+    stopping = false;
+    for (int i = 1; i < threadCount; i++)
+        workers.push_back(std::thread{ &ThreadPool::work, this, generation });
+}
+
+void ThreadPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        stopping = true;
+    }
+    startCondition.notify_all();
+    for (int i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+}
+
+void ThreadPool::work(unsigned int seenGeneration)
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock{ mutex };
+            startCondition.wait(lock, [this, seenGeneration] { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = generation;
+        }
+
+        takeJobs();
+
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            busyWorkers--;
+        }
+        doneCondition.notify_one();
+    }
+}
+
+void ThreadPool::takeJobs()
+{
+    for (int i = nextJob++; i < jobCount; i = nextJob++)
+        (*job)(i);
+}
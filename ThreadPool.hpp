@@ -0,0 +1,46 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // A thread count of 0 uses one thread per hardware core
+    ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void setThreadCount(int threadCount);
+    int getThreadCount() const;
+
+    // Calls job(i) for every i in [0, jobCount) across all threads, the
+    // calling thread included, and returns once every job has finished
+    void run(int jobCount, const std::function<void(int)>& job);
+private:
+    void startWorkers(int threadCount);
+    void stopWorkers();
+    void work(unsigned int seenGeneration);
+    void takeJobs();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+
+    const std::function<void(int)>* job;
+    int jobCount;
+    std::atomic<int> nextJob;
+    int busyWorkers;
+    unsigned int generation;
+    bool stopping;
+};
+
+#endif
@@ -1,7 +1,97 @@
 #include "Driver.hpp"
+#include "OfflineRenderer.hpp"
+#include "PipeSink.hpp"
+#include "ShmRingSink.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+// main --offline frames prefix [ppm|raw|none|pipe|shm] [frame threads]
+// Renders the bricks scene along an orbit without opening a window. pipe
+// streams raw RGBA to standard output and shm to a shared-memory ring
+// named by prefix (like /frames) for an encoder to pick up; both wait for
+// the consumer
+int runOffline(int argc, char* argv[])
+{
+    int frameCount = argc > 2 ? std::stoi(argv[2]) : 60;
+    std::string prefix = argc > 3 ? argv[3] : "frame_";
+    std::string format = argc > 4 ? argv[4] : "ppm";
+    int frameThreads = argc > 5 ? std::stoi(argv[5]) : 1;
+
+    Mesh* bricks = Mesh::loadFromFile("bricks.obj", Mesh::Shading::KEEP_NORMALS);
+    sf::Image image;
+    if (bricks == nullptr || !image.loadFromFile("bricks.jpg"))
+    {
+        std::cerr << "Couldn't load the scene" << std::endl;
+        delete bricks;
+        return 1;
+    }
+    Raster bricksTex{ (int) image.getSize().x, (int) image.getSize().y };
+    bricksTex.setLayout(Raster::Layout::TILED);
+    bricksTex.loadFromBuffer(image.getPixelsPtr());
+    bricksTex.generateMipmaps();
+
+    std::vector<LightSource> lights;
+    lights.push_back(LightSource{ AmbientLight{ Vector3{ 0.4, 0.4, 0.5 } } });
+    lights.push_back(LightSource{ DirectionalLight{ Vector3{ 0.6, 0.6, 0.8 }, Vector3{ 1.0, -1.0, -1.0 } } });
+
+    std::vector<OfflineRenderer::CameraKey> path;
+    const int keyCount = 9;
+    for (int i = 0; i < keyCount; i++)
+    {
+        double angle = 6.283185307 * i / (keyCount - 1);
+        path.push_back(OfflineRenderer::CameraKey{ Vector3{ 5.0 * sin(angle), 1.0, 5.0 * cos(angle) }, angle, -0.2 });
+    }
+
+    OfflineRenderer offline{ 800, 600 };
+    offline.setScene(bricks, &bricksTex, lights, Renderer::Lighting::DIFFUSE);
+    offline.setCameraPath(path);
+    offline.setRendererSetup([](Renderer& renderer)
+    {
+        renderer.enableBinning(true);
+        renderer.enableFastClears(true);
+        renderer.setDepthFormat(DepthBuffer::Format::FLOAT32);
+        renderer.setPerspectiveCorrection(Renderer::PerspectiveCorrection::SPAN_16);
+        renderer.setMipmapSelection(Renderer::MipmapSelection::PER_SPAN);
+        renderer.setSampler(Sampler{ Sampler::Filter::BILINEAR, Sampler::Address::REPEAT });
+    });
+    PostProcess postProcess;
+    postProcess.setTonemap(1.2, 3.0);
+    postProcess.setVignette(0.4, 0.5);
+    offline.setPostProcess(postProcess);
+    OfflineRenderer::OutputFormat outputFormat = OfflineRenderer::OutputFormat::PPM;
+    if (format == "raw")
+        outputFormat = OfflineRenderer::OutputFormat::RAW;
+    else if (format == "none")
+        outputFormat = OfflineRenderer::OutputFormat::NONE;
+    offline.setOutput(prefix, outputFormat);
+    offline.setFrameThreads(frameThreads);
+    std::unique_ptr<FrameSink> sink;
+    if (format == "pipe")
+        sink = std::make_unique<PipeSink>(800, 600, FrameSink::Backpressure::BLOCK);
+    else if (format == "shm")
+        sink = std::make_unique<ShmRingSink>(prefix, 800, 600, 4, FrameSink::Backpressure::BLOCK);
+    offline.setSink(sink.get());
+    // Standard output may be carrying the frames
+    std::ostream& log = sink ? std::cerr : std::cout;
+
+    auto start = std::chrono::steady_clock::now();
+    int failures = offline.render(frameCount);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    log << frameCount << " frames in " << seconds << " s, " << frameCount / seconds << " FPS" << std::endl;
+    if (failures > 0)
+        log << failures << " frames couldn't be written" << std::endl;
+
+    delete bricks;
+    return failures > 0 ? 1 : 0;
+}
 
 int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string{ argv[1] } == "--offline")
+        return runOffline(argc, argv);
+
     Driver driver{ 800, 600, 1 };
     driver.start();
 